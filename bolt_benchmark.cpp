@@ -0,0 +1,645 @@
+//
+// MAT201B Final Project
+// Fall 2015
+//
+// Headless micro-benchmarks of the bolt pipeline: bolt generation (the old
+// recursive makeBolt, kept below as the baseline, against BoltGenerator,
+// and Bolt::makeBolt over a grid of n, branches and branch probability),
+// the ribbon expansion kernels, high detail and dielectric breakdown bolts
+// on 1 .. n threads, the per-frame bulge and batching of the live bolts, the
+// simulator's State packing and the renderer's unpacking, and how long a
+// State takes to get from simulator to renderer over loopback UDP the way
+// cuttlebone sends it and through the shared memory triple buffer. It also
+// checks that a renderer reading shared memory drops its bolts when the
+// simulator restarts under it, rather than drawing old geometry for the
+// ids the new run hands out again.
+//
+// It builds against bolt_headless.hpp instead of allocore, so it needs no
+// AlloSystem, window, PhaseSpace or network:
+//
+//    g++ -std=c++11 -O3 -pthread bolt_benchmark.cpp -o bolt_benchmark
+//    ./bolt_benchmark > results.json
+//
+// Tables go to stderr. stdout gets one JSON object per measurement with
+// ns_per_op, allocs_per_op (heap allocations) and, for the State, the
+// bytes per frame, to compare against an earlier run. Add
+// -DBOLT_REPLICATION=0 for the geometry wire format and -DMAX_BOLTS=4096
+// for a crowded sky.
+//
+
+#define BOLT_HEADLESS
+#include "bolt_headless.hpp"
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+using namespace al;
+using namespace std;
+
+#define MAX_BOLT_SEGMENTS (1 << 15)  // room for the high detail bolts
+#include "common_4.hpp"
+#include "plasma_simulation.hpp"
+
+// every heap allocation, so a change that starts allocating per frame shows
+static atomic<long> allocations(0);
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = malloc(size ? size : 1)) return p;
+  throw bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+
+// Bolt::makeBolt before BoltGenerator: recursive, sorts its positions,
+// allocates a vector per call and pushes vertices one at a time
+void legacyMakeBolt(Mesh& mesh, BoltRandom& rng, const Color& color,
+                    Vec3f source, Vec3f dest, int maxBranches, float branchProb,
+                    float wid, int n) {
+  Vec3f tangent = (dest - source);
+  Vec3f normal = tangent.cross(Vec3f(0, 0, -1)).normalize();
+  float length = tangent.mag();
+
+  vector<float> positions;
+  positions.push_back(0);
+  for (int i = 0; i < n; i++) positions.push_back(rng.uniform());
+  sort(positions.begin(), positions.end());
+
+  float sway = 1;
+  float jaggedness = 1 / sway;
+  Vec3f prevPoint = source;
+  float prevDisplacement = 0;
+  float width = (wid > 0) ? wid : length / 25.0 + 0.01;
+  int branches = 0;
+  mesh.primitive(Graphics::TRIANGLES);
+  Vec3f point;
+
+  for (int i = 1; i < n; i++) {
+    float pos = positions[i];
+    float scale = (length * jaggedness) * (pos - positions[i - 1]);
+    float envelope = pos > 0.95f ? mapRange(pos, 0.95f, 1.0f, 1.0f, 0.0f) : 1;
+    float displacement = rng.uniformS(sway) * scale + prevDisplacement;
+    displacement *= envelope;
+    point = source + pos * tangent + displacement * normal;
+    mesh.vertex(prevPoint + normal * width);
+    mesh.vertex(prevPoint - normal * width);
+    mesh.vertex(point + normal * width);
+    mesh.vertex(point + normal * width);
+    mesh.vertex(prevPoint - normal * width);
+    mesh.vertex(point - normal * width);
+    mesh.texCoord(0, (float)(i - 1) / n);
+    mesh.texCoord(1, (float)(i - 1) / n);
+    mesh.texCoord(0, (float)(i) / n);
+    mesh.texCoord(0, (float)(i) / n);
+    mesh.texCoord(1, (float)(i - 1) / n);
+    mesh.texCoord(1, (float)(i) / n);
+    for (int k = 0; k < 6; k++) mesh.color(color);
+    if (branches < maxBranches && rng.prob(branchProb)) {
+      branches++;
+      Vec3f dir(tangent);
+      rotate(dir, Vec3f(0, 0, 1), rng.uniformS(30) * M_DEG2RAD);
+      dir.normalize();
+      float len = (dest - point).mag();
+      legacyMakeBolt(mesh, rng, color, point, point + dir * len * 0.4, maxBranches - 1,
+                     branchProb, width * 0.6, n * 0.5);
+    }
+    prevPoint = point;
+    prevDisplacement = displacement;
+  }
+  mesh.vertex(point + normal * width);
+  mesh.vertex(point - normal * width);
+  mesh.vertex(dest + normal * width);
+  mesh.vertex(dest + normal * width);
+  mesh.vertex(point - normal * width);
+  mesh.vertex(dest - normal * width);
+  mesh.texCoord(0, (float)(n - 1) / n);
+  mesh.texCoord(1, (float)(n - 1) / n);
+  mesh.texCoord(0, (float)(n) / n);
+  mesh.texCoord(0, (float)(n) / n);
+  mesh.texCoord(1, (float)(n - 1) / n);
+  mesh.texCoord(1, (float)(n) / n);
+  for (int k = 0; k < 6; k++) mesh.color(color);
+}
+
+double nsSince(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+}
+
+// one measurement as a line of JSON on stdout. fields is the part that
+// says what was measured, e.g. "\"n\":80"; bytes < 0 leaves bytes out
+void report(const char* bench, const char* fields, double ns, double allocs,
+            double bytes = -1) {
+  printf("{\"bench\":\"%s\"%s%s,\"ns_per_op\":%.1f,\"allocs_per_op\":%.3f", bench,
+         fields[0] ? "," : "", fields, ns, allocs);
+  if (bytes >= 0) printf(",\"bytes_per_frame\":%.0f", bytes);
+  printf("}\n");
+  fflush(stdout);
+}
+
+// hash of the generator's points, to check that thread count doesn't
+// change a bolt
+unsigned hashPoints(const BoltGenerator& generator, unsigned hash) {
+  for (int k = 0; k < generator.points; k++) {
+    unsigned bits[3];
+    memcpy(bits, &generator.x[k], 4);
+    memcpy(bits + 1, &generator.y[k], 4);
+    memcpy(bits + 2, &generator.z[k], 4);
+    for (int b = 0; b < 3; b++) hash = (hash ^ bits[b]) * 16777619u;
+  }
+  return hash;
+}
+
+// per-frame transport latency: from a packed State being ready on the
+// simulator to the renderer being able to read it, in microseconds
+const int TRANSPORT_FRAMES = 2000;
+static atomic<uint64_t> readyAt[TRANSPORT_FRAMES];  // steady ns, by frame
+
+uint64_t steadyNs() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+           chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// cuttlebone's way: Maker::set copies the State, its thread sends it in
+// packets that a Taker reassembles and get() copies out again
+struct StatePacket {
+  uint32_t frame;
+  uint16_t part, parts;
+  char data[STATE_PACKET_SIZE - 8];
+};
+
+int udpLatency(const State& packed, vector<double>& latency) {
+  int in = socket(AF_INET, SOCK_DGRAM, 0), out = socket(AF_INET, SOCK_DGRAM, 0);
+  int buffer = 8 << 20;
+  setsockopt(in, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof buffer);
+  timeval wait = {0, 200000};
+  setsockopt(in, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof wait);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof address;
+  if (bind(in, (sockaddr*)&address, sizeof address) != 0 ||
+      getsockname(in, (sockaddr*)&address, &length) != 0) {
+    return -1;
+  }
+  const int parts = (sizeof(State) + sizeof(StatePacket::data) - 1) / sizeof(StatePacket::data);
+  thread taker([&]() {
+    static State assembling, taken;
+    StatePacket packet;
+    int frame = -1, got = 0;
+    while (recv(in, &packet, sizeof packet, 0) > 0) {
+      if ((int)packet.frame != frame) {
+        frame = packet.frame;
+        got = 0;
+      }
+      size_t at = packet.part * sizeof packet.data;
+      memcpy((char*)&assembling + at, packet.data, min(sizeof packet.data, sizeof(State) - at));
+      if (++got < parts) continue;
+      memcpy(&taken, &assembling, sizeof(State));
+      latency.push_back((steadyNs() - readyAt[frame]) / 1e3);
+      if (frame == TRANSPORT_FRAMES - 1) break;
+    }
+  });
+  static State made;
+  StatePacket packet;
+  for (int f = 0; f < TRANSPORT_FRAMES; f++) {
+    readyAt[f] = steadyNs();
+    memcpy(&made, &packed, sizeof(State));
+    for (int p = 0; p < parts; p++) {
+      packet.frame = f;
+      packet.part = p;
+      packet.parts = parts;
+      size_t at = p * sizeof packet.data;
+      memcpy(packet.data, (char*)&made + at, min(sizeof packet.data, sizeof(State) - at));
+      sendto(out, &packet, sizeof packet, 0, (sockaddr*)&address, sizeof address);
+    }
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  taker.join();
+  close(in);
+  close(out);
+  return parts;
+}
+
+bool sharedLatency(const State& packed, vector<double>& latency) {
+  static SharedStateWriter writer;
+  static SharedStateReader reader;
+  if (!writer.create("/plasmaball_benchmark") || !reader.open("/plasmaball_benchmark")) {
+    return false;
+  }
+  atomic<bool> done(false);
+  thread taker([&]() {
+    const State* state;
+    int last = -1;
+    while (!done) {
+      if (reader.take(state) && state->frame != last) {
+        last = state->frame;
+        latency.push_back((steadyNs() - readyAt[last]) / 1e3);
+      } else {
+        this_thread::yield();
+      }
+    }
+  });
+  for (int f = 0; f < TRANSPORT_FRAMES; f++) {
+    // the simulator packs in place, so the State is ready once it is in
+    // the slot
+    State& state = writer.next();
+    memcpy(&state, &packed, sizeof(State));
+    state.frame = f;
+    readyAt[f] = steadyNs();
+    writer.publish();
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  this_thread::sleep_for(chrono::milliseconds(20));
+  done = true;
+  taker.join();
+  shm_unlink("/plasmaball_benchmark");
+  return true;
+}
+
+// a simulator run in a child process packing straight into shared memory
+// as simulator_headless --transport shm does. every child starts from the
+// same bolt id counter, like a restarted simulator, and stops while its
+// first bolts are still live
+pid_t sharedRun(uint64_t seed) {
+  pid_t pid = fork();
+  if (pid != 0) return pid;
+  static SharedStateWriter writer;
+  PlasmaSimulation* sim = new PlasmaSimulation(seed);
+  sim->pace = 0;
+  sim->upperbound = 0.1;
+  if (!writer.create("/plasmaball_restart")) _exit(1);
+  for (int f = 0; f < 30; f++) {
+    sim->advance(1 / ANIMATION_RATE);
+    sim->settle();
+    sim->pack(Pose(), false, writer.next());
+    writer.publish();
+    sim->state.frame++;
+    this_thread::sleep_for(chrono::milliseconds(2));
+  }
+  _exit(0);
+}
+
+// two simulator runs one after the other under one live renderer: the
+// bolts the second run sends geometry for must be the ones the renderer
+// draws. returns how many weren't, -1 if shared memory is unavailable
+int sharedRestart(int& checked) {
+  static SharedStateReader reader;
+  static BoltCache cache;
+  shm_unlink("/plasmaball_restart");
+  int stale = 0;
+  checked = 0;
+  for (uint64_t seed = 1; seed <= 2; seed++) {
+    pid_t pid = sharedRun(seed);
+    if (pid < 0) return -1;
+    int status = 0;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+      const State* state;
+      if ((!reader.opened() && !reader.open("/plasmaball_restart")) || !reader.take(state)) {
+        this_thread::yield();
+        continue;
+      }
+      cache.sync(*state);
+      for (int g = 0; g < state->numberOfGeometries; g++) {
+#if BOLT_REPLICATION == REPLICATE_SEED
+        unsigned id = state->seedBolt[g].id;
+        Vec3f ending = state->seedBolt[g].seed.dest;
+#else
+        unsigned id = state->flatBolt[g].id;
+        Vec3f ending = state->flatBolt[g].ending;
+#endif
+        int k = cache.find(id);
+        if (k < 0 || cache.bolts[k].ending != ending) stale++;
+        checked++;
+      }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+  }
+  shm_unlink("/plasmaball_restart");
+  return stale;
+}
+
+int main() {
+  char fields[256];
+  Vec3f source(4.f, 1.f, -2.f), dest(0.1f, 0.6f, -1.f);
+  Vec3f center(0, 0.6, -1);
+  Color color(1, 0.7, 1, 1);
+  Mesh mesh;
+
+  // the new generator stops taking branches at VERTEX_COUNT, so compare the
+  // vertex counts as well as the times; its meshes are indexed, two vertices
+  // per point instead of six per segment. a row where the budget left out
+  // branches did less work than the legacy one, it shows the share of bolts
+  // clipped instead of a speedup
+  struct { int n, maxBranches; float branchProb; } cases[] = {
+    {80, 2, 0.03f},   // PhaseSpace pinch
+    {80, 4, 0.06f},   // timed strike
+    {160, 4, 0.1f},
+    {400, 6, 0.1f},
+  };
+  const int bolts = 20000;
+  fprintf(stderr, "%6s %4s %6s %14s %12s %14s %12s %9s\n", "n", "br", "prob",
+          "legacy ns/bolt", "legacy verts", "new ns/bolt", "new verts", "speedup");
+  for (auto& c : cases) {
+    BoltRandom rng(1);
+    long legacyVertices = 0, currentVertices = 0;
+    long before = allocations;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < bolts; i++) {
+      mesh.reset();
+      rng.reseed(i + 1);
+      legacyMakeBolt(mesh, rng, color, source, dest, c.maxBranches, c.branchProb, 0.05, c.n);
+      legacyVertices += mesh.vertices().size();
+    }
+    double legacy = nsSince(start) / bolts;
+    double legacyAllocs = (double)(allocations - before) / bolts;
+
+    BoltGenerator& generator = BoltGenerator::shared();
+    before = allocations;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < bolts; i++) {
+      mesh.reset();
+      rng.reseed(i + 1);
+      generator.generate(rng, source, dest, c.maxBranches, c.branchProb, 0.05, c.n);
+      generator.emit(mesh, color);
+      currentVertices += mesh.vertices().size();
+    }
+    double current = nsSince(start) / bolts;
+    double currentAllocs = (double)(allocations - before) / bolts;
+
+    // untimed: the same bolts again without the budget
+    int clipped = 0;
+    for (int i = 0; i < bolts; i++) {
+      rng.reseed(i + 1);
+      int budgeted = generator.generate(rng, source, dest, c.maxBranches, c.branchProb, 0.05, c.n);
+      rng.reseed(i + 1);
+      int whole = generator.generate(rng, source, dest, c.maxBranches, c.branchProb, 0.05, c.n,
+                                     MAX_BOLT_SEGMENTS * 6);
+      if (budgeted < whole) clipped++;
+    }
+
+    char speedup[16];
+    if (clipped > 0) snprintf(speedup, sizeof speedup, "%3.0f%% clip", 100.0 * clipped / bolts);
+    else snprintf(speedup, sizeof speedup, "%.2fx", legacy / current);
+    fprintf(stderr, "%6d %4d %6.2f %14.0f %12ld %14.0f %12ld %9s\n", c.n, c.maxBranches,
+            c.branchProb, legacy, legacyVertices / bolts, current, currentVertices / bolts,
+            speedup);
+    snprintf(fields, sizeof fields, "\"n\":%d,\"branches\":%d,\"prob\":%g,\"clipped\":%.3f",
+             c.n, c.maxBranches, c.branchProb, (double)clipped / bolts);
+    report("legacyMakeBolt", fields, legacy, legacyAllocs);
+    report("generate", fields, current, currentAllocs);
+  }
+
+  // Bolt::makeBolt the way strikes call it, over the shape parameters
+  fprintf(stderr, "\nBolt::makeBolt\n%6s %4s %6s %10s %8s %10s\n", "n", "br", "prob",
+          "ns/bolt", "verts", "allocs");
+  {
+    static Bolt bolt;
+    int ns[] = {40, 80, 160, 400};
+    int branches[] = {0, 2, 4, 6};
+    float probs[] = {0.03f, 0.1f};
+    for (int n : ns) {
+      for (int maxBranches : branches) {
+        for (float branchProb : probs) {
+          const int repeats = 4000;
+          long vertices = 0;
+          long before = allocations;
+          auto start = chrono::steady_clock::now();
+          for (int i = 0; i < repeats; i++) {
+            bolt.mesh.reset();
+            bolt.rng.reseed(i + 1);
+            bolt.makeBolt(source, dest, maxBranches, branchProb, 0.05, n);
+            vertices += bolt.mesh.vertices().size();
+          }
+          double ns = nsSince(start) / repeats;
+          double allocs = (double)(allocations - before) / repeats;
+          fprintf(stderr, "%6d %4d %6.2f %10.0f %8ld %10.3f\n", n, maxBranches, branchProb,
+                  ns, vertices / repeats, allocs);
+          snprintf(fields, sizeof fields, "\"n\":%d,\"branches\":%d,\"prob\":%g", n,
+                   maxBranches, branchProb);
+          report("makeBolt", fields, ns, allocs);
+        }
+      }
+    }
+  }
+
+  // ribbon expansion alone, on a bolt at the full vertex budget
+  struct { const char* name; RibbonKernel kernel; } kernels[] = {
+    {"scalar", ribbonScalar},
+#ifdef BOLT_RIBBON_X86
+    {"sse", ribbonSSE},
+    {"avx2", ribbonAVX2},
+#endif
+  };
+  BoltGenerator& generator = BoltGenerator::shared();
+  BoltRandom rng(1);
+  generator.generate(rng, source, dest, 6, 0.1, 0.05, 400);
+  fprintf(stderr, "\nribbon expansion, %d points (best kernel here: %s)\n", generator.points,
+          bestRibbonKernel() == ribbonScalar ? "scalar" : "simd");
+  for (auto& k : kernels) {
+#ifdef BOLT_RIBBON_X86
+    if (k.kernel == ribbonAVX2 && !__builtin_cpu_supports("avx2")) continue;
+#endif
+    generator.kernel = k.kernel;
+    const int repeats = 200000;
+    long before = allocations;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++) generator.expand();
+    double ns = nsSince(start) / repeats;
+    fprintf(stderr, "%8s %10.1f ns/expand\n", k.name, ns);
+    snprintf(fields, sizeof fields, "\"kernel\":\"%s\",\"points\":%d", k.name,
+             generator.points);
+    report("ribbon", fields, ns, (double)(allocations - before) / repeats);
+  }
+  generator.kernel = bestRibbonKernel();
+
+  // high detail bolts laid out on more and more threads, the points have
+  // to come out the same every time
+  const int detail = 6 * MAX_BOLT_SEGMENTS;
+  unsigned reference = 0;
+  fprintf(stderr, "\nhigh detail, n 4000, 8 branches, prob 0.02\n");
+  int most = max(4, (int)thread::hardware_concurrency());
+  for (int count = 1; count <= most; count *= 2) {
+    BoltThreads threads(count);
+    generator.threads = count > 1 ? &threads : 0;
+    const int repeats = 50;
+    unsigned hash = 2166136261u;
+    long before = allocations;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++) {
+      rng.reseed(i + 1);
+      generator.generate(rng, source, dest, 8, 0.02, 0.05, 4000, detail);
+      hash = hashPoints(generator, hash);
+    }
+    double ns = nsSince(start) / repeats;
+    if (count == 1) reference = hash;
+    fprintf(stderr, "%3d threads %12.0f ns/bolt %6d points %s\n", count, ns, generator.points,
+            hash == reference ? "same" : "DIFFERENT");
+    snprintf(fields, sizeof fields, "\"threads\":%d,\"points\":%d,\"deterministic\":%s", count,
+             generator.points, hash == reference ? "true" : "false");
+    report("highDetail", fields, ns, (double)(allocations - before) / repeats);
+  }
+  generator.threads = 0;
+
+  // dielectric breakdown, same strike as above
+  DbmGenerator& dbm = DbmGenerator::shared();
+  fprintf(stderr, "\ndielectric breakdown, %d^3 cells\n", DBM_GRID);
+  for (int count = 1; count <= most; count *= 2) {
+    BoltThreads threads(count);
+    dbm.threads = count > 1 ? &threads : 0;
+    const int repeats = 20;
+    unsigned hash = 2166136261u;
+    long indices = 0;
+    long before = allocations;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++) {
+      rng.reseed(i + 1);
+      indices += dbm.generate(generator, rng, source, dest, 4, 0.05);
+      hash = hashPoints(generator, hash);
+    }
+    double ns = nsSince(start) / repeats;
+    if (count == 1) reference = hash;
+    fprintf(stderr, "%3d threads %12.0f ns/bolt %6ld indices %s\n", count, ns,
+            indices / repeats, hash == reference ? "same" : "DIFFERENT");
+    snprintf(fields, sizeof fields, "\"threads\":%d,\"indices\":%ld,\"deterministic\":%s",
+             count, indices / repeats, hash == reference ? "true" : "false");
+    report("breakdown", fields, ns, (double)(allocations - before) / repeats);
+  }
+  dbm.threads = 0;
+
+  // fade and bulge of the live bolts: update() alone, then with the frame's
+  // BoltBatch, which carries the fade to the shaders
+  static Bolt crowd[MAX_BOLTS];
+  static BoltSystem live;
+  static BoltBatch batch;
+  for (int i = 0; i < MAX_BOLTS; i++) {
+    BoltSeed seed(source, dest, 4, 0.06, i * 0.001);
+    seed.nucleus = center;
+    crowd[i].strike(seed);
+  }
+  fprintf(stderr, "\nfade and bulge\n");
+  for (int count = max(MAX_BOLTS / 16, 1); count <= MAX_BOLTS; count *= 4) {
+    live.clear();
+    for (int i = 0; i < count; i++) live.add(&crowd[i]);
+    for (int batched = 0; batched < 2; batched++) {
+      const int frames = batched ? 200 : 20000;
+      long before = allocations;
+      auto start = chrono::steady_clock::now();
+      for (int f = 0; f < frames; f++) {
+        live.update(0.3 + f / ANIMATION_RATE);
+        if (!batched) continue;
+        batch.reset();
+        for (int i = 0; i < count; i++) {
+          batch.add(*live.bolt[i], Vec3f(0, 0.45f, 0), center, live.fadeExponent[i]);
+        }
+      }
+      double ns = nsSince(start) / frames;
+      fprintf(stderr, "%6d bolts %-14s %10.0f ns/frame %8.2f ns/bolt\n", count,
+              batched ? "update + batch" : "update", ns, ns / count);
+      snprintf(fields, sizeof fields, "\"bolts\":%d,\"batch\":%s", count,
+               batched ? "true" : "false");
+      report("animate", fields, ns, (double)(allocations - before) / frames);
+    }
+  }
+
+  // the frame loop of simulator and renderer without the drawing: strikes
+  // keep coming, the simulator animates and packs its bolts into a State,
+  // and a renderer unpacks it into its cache
+  static BoltPool pool;
+  static BoltCache cache;
+  static State state;
+  fprintf(stderr, "\nState, %s replication, %d bytes\n",
+          BOLT_REPLICATION == REPLICATE_SEED ? "seed" : "geometry", (int)sizeof(State));
+  int rates[] = {1, 3};  // strikes per frame, ~90 and ~270 live bolts
+  for (int rate : rates) {
+    const int warmUp = 200, frames = 2000;
+    double packNs = 0, unpackNs = 0, bytes = 0;
+    long packAllocs = 0, unpackAllocs = 0, live = 0;
+    state.frame = 0;
+    state.time = 0;
+    BoltRandom strikes(rate);
+    for (int f = 0; f < warmUp + frames; f++) {
+      state.time += 1 / ANIMATION_RATE;
+      for (int k = 0; k < rate; k++) {
+        Vec3f from = Vec3f(strikes.uniformS(), strikes.uniformS(), strikes.uniformS());
+        from.normalize(R * 0.9f);
+        Vec3f to = (from - center).normalize() * 0.1f + center;
+        pool.spawn(BoltSeed(from, to, 4, 0.06, state.time), center);
+      }
+      pool.animate(state.time);
+      pool.retireExpired();
+
+      long before = allocations;
+      auto start = chrono::steady_clock::now();
+      packBolts(state, pool);
+      double pack = nsSince(start);
+      long packed = allocations - before;
+
+      before = allocations;
+      start = chrono::steady_clock::now();
+      cache.unpack(state);
+      double unpack = nsSince(start);
+      long unpacked = allocations - before;
+      state.frame++;
+
+      if (f < warmUp) continue;
+      packNs += pack;
+      unpackNs += unpack;
+      packAllocs += packed;
+      unpackAllocs += unpacked;
+      bytes += usedBytes(state);
+      live += pool.size();
+    }
+    fprintf(stderr, "%3d strikes/frame %4ld live  pack %9.0f ns  unpack %9.0f ns  %7.0f bytes used\n",
+            rate, live / frames, packNs / frames, unpackNs / frames, bytes / frames);
+    snprintf(fields, sizeof fields,
+             "\"replication\":\"%s\",\"strikes_per_frame\":%d,\"live\":%ld,\"state_bytes\":%d",
+             BOLT_REPLICATION == REPLICATE_SEED ? "seed" : "geometry", rate, live / frames,
+             (int)sizeof(State));
+    report("pack", fields, packNs / frames, (double)packAllocs / frames, bytes / frames);
+    report("unpack", fields, unpackNs / frames, (double)unpackAllocs / frames, bytes / frames);
+  }
+
+  // the last State packed above, ~270 live bolts, from simulator to renderer
+  fprintf(stderr, "\n%10s %8s %12s %12s %12s\n", "transport", "frames", "p50 us", "p99 us",
+          "copied/frame");
+  for (int shared = 0; shared < 2; shared++) {
+    vector<double> latency;
+    latency.reserve(TRANSPORT_FRAMES);
+    long before = allocations;
+    if (shared ? !sharedLatency(state, latency) : udpLatency(state, latency) < 0) {
+      fprintf(stderr, "%10s unavailable\n", shared ? "shm" : "udp");
+      continue;
+    }
+    long allocs = allocations - before;
+    if (latency.empty()) continue;
+    sort(latency.begin(), latency.end());
+    double p50 = latency[latency.size() / 2], p99 = latency[latency.size() * 99 / 100];
+    int copied = shared ? 0 : 4 * sizeof(State);  // set, send, reassemble, get
+    fprintf(stderr, "%10s %8d %12.1f %12.1f %12d\n", shared ? "shm" : "udp", (int)latency.size(),
+            p50, p99, copied);
+    snprintf(fields, sizeof fields,
+             "\"transport\":\"%s\",\"frames\":%d,\"p50_us\":%.1f,\"p99_us\":%.1f,\"state_bytes\":%d",
+             shared ? "shm" : "udp", (int)latency.size(), p50, p99, (int)sizeof(State));
+    report("transport", fields, p50 * 1e3, (double)allocs / TRANSPORT_FRAMES, copied);
+  }
+
+  // a simulator restarting under a renderer on shared memory
+  int checked = 0;
+  int stale = sharedRestart(checked);
+  if (stale < 0) {
+    fprintf(stderr, "\nshm restart unavailable\n");
+  } else {
+    fprintf(stderr, "\nshm restart: %d geometries checked, %d stale %s\n", checked, stale,
+            stale == 0 ? "" : "WRONG");
+    snprintf(fields, sizeof fields, "\"checked\":%d,\"stale\":%d", checked, stale);
+    report("restart", fields, 0, 0);
+  }
+}
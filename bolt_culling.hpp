@@ -0,0 +1,89 @@
+#ifndef __BOLT_CULLING__
+#define __BOLT_CULLING__
+
+// Per face culling for the omni renderer
+//
+// OmniStereoGraphicsRenderer calls onDraw once for every face of its cube
+// map and every eye, and each face only looks at a sixth of the directions
+// around the viewer. A bolt usually shows on one or two of them, so the
+// renderer asks FaceCuller, face by face, which bolts and bulges can be
+// seen there and leaves the rest out of that face's draw.
+//
+// Face f looks along an axis of eye space, in cube map order: +x, -x, +y,
+// -y, +z, -z (omni_render turns each face's vertices the same way). Its
+// frustum is the 90 degree pyramid around that axis, four planes through
+// the eye. Bulges are bounded by spheres; bolts by boxes, since a long thin
+// bolt fills only a little of its sphere. The stereo eye sits up to margin
+// away from the pose, so bounds are tested that much bigger.
+
+#ifdef BOLT_HEADLESS
+#include "bolt_headless.hpp"
+#else
+#include "allocore/io/al_App.hpp"
+#endif
+#include <cmath>
+
+#define CUBE_FACES (6)
+
+class FaceCuller {
+  public:
+  // what the faces drew and left out since the last clearCounts()
+  int passes;  // faces drawn, both eyes count
+  int boltsDrawn, boltsCulled;
+  int bulgesDrawn, bulgesCulled;
+
+  FaceCuller() : margin(0) { clearCounts(); }
+
+  void clearCounts(){
+    passes = boltsDrawn = boltsCulled = bulgesDrawn = bulgesCulled = 0;
+  }
+
+  // where the faces look from this frame, and how far an eye can be from it
+  void look(const Pose& pose, float eyeMargin){
+    Vec3f axis[3] = { pose.ur(), pose.uu(), -pose.uf() };  // eye space x, y, z
+    eye = pose.pos();
+    margin = eyeMargin;
+    // the planes between a face and its neighbours point into the face,
+    // halfway between its axis and theirs
+    for(int face = 0; face < CUBE_FACES; face++){
+      int k = face / 2;
+      Vec3f ahead = face % 2 ? -axis[k] : axis[k];
+      for(int p = 0; p < 4; p++){
+        Vec3f across = axis[(k + 1 + p / 2) % 3] * (p % 2 ? -1.f : 1.f);
+        plane[face][p] = (ahead - across) * (float)M_SQRT1_2;
+      }
+    }
+  }
+
+  // whether the sphere can show on face, 0 .. CUBE_FACES - 1. anything
+  // else isn't a cube face and sees everything
+  bool visible(int face, const Vec3f& center, float radius) const {
+    if(face < 0 || face >= CUBE_FACES) return true;
+    Vec3f d = center - eye;
+    for(int p = 0; p < 4; p++){
+      if(d.dot(plane[face][p]) < -(radius + margin)) return false;
+    }
+    return true;
+  }
+
+  // whether the box center +- halfSize can. it reaches furthest into a
+  // plane at halfSize . |normal| from its centre
+  bool visible(int face, const Vec3f& center, const Vec3f& halfSize) const {
+    if(face < 0 || face >= CUBE_FACES) return true;
+    Vec3f d = center - eye;
+    for(int p = 0; p < 4; p++){
+      const Vec3f& n = plane[face][p];
+      float reach = halfSize.x * std::fabs(n.x) + halfSize.y * std::fabs(n.y) +
+                    halfSize.z * std::fabs(n.z);
+      if(d.dot(n) < -(reach + margin)) return false;
+    }
+    return true;
+  }
+
+  private:
+  Vec3f eye;
+  float margin;
+  Vec3f plane[CUBE_FACES][4];  // normals of the planes through the eye
+};
+
+#endif
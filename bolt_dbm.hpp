@@ -0,0 +1,403 @@
+#ifndef __BOLT_DBM__
+#define __BOLT_DBM__
+
+// Dielectric breakdown bolts
+//
+// An alternative to the random walk in BoltGenerator, after the dielectric
+// breakdown model of the FAST_LIGHTNING paper (see the ReadMe). A cube of
+// cells spans the strike. The channel starts as the cell at the source and
+// the cells around the destination are held at potential 1. Every step
+// solves the Laplace equation for the potential of the free cells with
+// conjugate gradients, warm started from the step before since a few new
+// channel cells barely change it, then grows the channel by free cells next
+// to it picked with probability potential ^ DBM_ETA, until it touches the
+// destination. Cells outside the plasma shell (R) are not part of the domain.
+//
+// The channel is a tree of cells. Its path to the destination becomes the
+// main run and its longest other limbs the branches, written into a
+// BoltGenerator, so emit() and everything after it don't change.
+//
+// Grid, growth and iterations are kept small enough that a bolt takes a few
+// milliseconds, since renderers lay out every breakdown bolt again. They do
+// it on a BoltWorker, but the bolt only shows once it is done.
+//
+// With a BoltThreads pool the solver passes run in parallel over fixed
+// chunks of cells and the chunks' sums are added in chunk order, so a bolt
+// is the same on any number of threads.
+//
+// Include after bolt_generator.hpp and R (common_4.hpp does).
+
+#include <algorithm>
+
+#ifndef DBM_GRID
+#define DBM_GRID (20)  // cells along each side of the cube
+#endif
+#define DBM_SIDE (DBM_GRID + 2)  // with a border of cells outside the domain
+#define DBM_CELLS (DBM_SIDE * DBM_SIDE * DBM_SIDE)
+#define DBM_ETA (3.0f)       // higher gives straighter bolts
+#define DBM_GROWTH (8)       // cells added to the channel per solve
+#define DBM_ITERATIONS (4)   // conjugate gradient iterations per solve
+#define DBM_CHUNK (1024)     // cells per solver task
+#define DBM_CHUNKS ((DBM_CELLS + DBM_CHUNK - 1) / DBM_CHUNK)
+
+class DbmGenerator {
+  public:
+  enum { FREE, CHANNEL, TARGET, OUTSIDE };
+
+  uint8_t type[DBM_CELLS];
+  float phi[DBM_CELLS];        // potential
+  float residual[DBM_CELLS];
+  float direction[DBM_CELLS];
+  float product[DBM_CELLS];    // A * direction
+  int parent[DBM_CELLS];       // channel cell it grew from
+  int children[DBM_CELLS];
+  bool listed[DBM_CELLS];      // in front[] or, once converted, in a run
+
+  int cell[DBM_CELLS];  // free cells, the solver's unknowns
+  int cells;
+  int grown[DBM_CELLS];  // channel cells in the order they grew
+  int channel;
+  int front[DBM_CELLS];  // free cells next to the channel
+  float weight[DBM_CELLS];
+  int fronts;
+
+  int path[DBM_CELLS];
+  uint64_t limb[DBM_CELLS];  // limbs to try as branches, longest first
+
+  double chunkSum[DBM_CHUNKS];
+  int pass;
+  float alpha;
+  float beta;
+
+  Vec3f origin;  // corner of the cube
+  float h;       // cell size
+  Vec3f source;
+  Vec3f dest;
+  uint32_t seed;
+
+  // runs the solver passes in parallel when set, in place when 0
+  BoltThreads* threads;
+
+  DbmGenerator() : threads(0) {}
+
+  // the generator the app thread uses
+  static DbmGenerator& shared(){
+    static DbmGenerator generator;
+    return generator;
+  }
+
+  // grow a bolt from s to d and lay it out in out, at most maxBranches * 4
+  // branches. returns the number of indices out.emit() will write
+  int generate(BoltGenerator& out, BoltRandom& rng, Vec3f s, Vec3f d, int maxBranches,
+               float wid, int budget = VERTEX_COUNT){
+    source = s;
+    dest = d;
+    seed = rng.next();
+    out.clear();
+
+    float side = (dest - source).mag() * 1.2f + 1e-3f;
+    h = side / DBM_GRID;
+    origin = (source + dest) * 0.5f - Vec3f(side, side, side) * 0.5f;
+    setUp();
+
+    int root = cellAt(source);
+    type[root] = FREE;
+    addChannel(root, -1);
+    int hit = touchesTarget(root) ? root : -1;
+    int most = DBM_GRID * DBM_GRID;
+    while(hit < 0 && fronts > 0 && channel < most){
+      listFree();
+      solve();
+      hit = grow(rng);
+    }
+    if(hit < 0) hit = closestToDest();
+
+    float width = (wid > 0) ? wid : (dest - source).mag() / 25.0 + 0.01;
+    layOut(out, hit, width, maxBranches * 4, std::min(budget / 6, MAX_BOLT_SEGMENTS));
+    return out.indexCount();
+  }
+
+  private:
+  int index(int i, int j, int k) const {
+    return (i + 1) + (j + 1) * DBM_SIDE + (k + 1) * DBM_SIDE * DBM_SIDE;
+  }
+
+  int cellAt(const Vec3f& p) const {
+    int i = std::min(std::max((int)((p.x - origin.x) / h), 0), DBM_GRID - 1);
+    int j = std::min(std::max((int)((p.y - origin.y) / h), 0), DBM_GRID - 1);
+    int k = std::min(std::max((int)((p.z - origin.z) / h), 0), DBM_GRID - 1);
+    return index(i, j, k);
+  }
+
+  Vec3f centerOf(int c) const {
+    int i = c % DBM_SIDE - 1;
+    int j = c / DBM_SIDE % DBM_SIDE - 1;
+    int k = c / (DBM_SIDE * DBM_SIDE) - 1;
+    return origin + Vec3f(i + 0.5f, j + 0.5f, k + 0.5f) * h;
+  }
+
+  static int neighbour(int c, int n){
+    static const int offset[6] = {1, -1, DBM_SIDE, -DBM_SIDE,
+                                  DBM_SIDE * DBM_SIDE, -DBM_SIDE * DBM_SIDE};
+    return c + offset[n];
+  }
+
+  void setUp(){
+    for(int c = 0; c < DBM_CELLS; c++){
+      type[c] = OUTSIDE;
+      phi[c] = 0;
+      residual[c] = 0;
+      direction[c] = 0;
+      product[c] = 0;
+      parent[c] = -1;
+      children[c] = 0;
+      listed[c] = false;
+    }
+    for(int k = 0; k < DBM_GRID; k++){
+      for(int j = 0; j < DBM_GRID; j++){
+        for(int i = 0; i < DBM_GRID; i++){
+          int c = index(i, j, k);
+          Vec3f p = centerOf(c);
+          if(p.mag() > R) continue;
+          if((p - dest).mag() < 1.5f * h){
+            type[c] = TARGET;
+            phi[c] = 1;
+          }else{
+            type[c] = FREE;
+          }
+        }
+      }
+    }
+    int end = cellAt(dest);
+    type[end] = TARGET;
+    phi[end] = 1;
+    channel = 0;
+    fronts = 0;
+  }
+
+  void addChannel(int c, int from){
+    type[c] = CHANNEL;
+    phi[c] = 0;
+    residual[c] = 0;
+    direction[c] = 0;
+    product[c] = 0;
+    parent[c] = from;
+    if(from >= 0) children[from]++;
+    grown[channel++] = c;
+    for(int n = 0; n < 6; n++){
+      int m = neighbour(c, n);
+      if(type[m] == FREE && !listed[m]){
+        listed[m] = true;
+        weight[fronts] = 0;  // not a candidate until the next solve
+        front[fronts++] = m;
+      }
+    }
+  }
+
+  bool touchesTarget(int c) const {
+    for(int n = 0; n < 6; n++){
+      if(type[neighbour(c, n)] == TARGET) return true;
+    }
+    return false;
+  }
+
+  // the unknowns, in cell order so every run of the solver sums the same way
+  void listFree(){
+    cells = 0;
+    for(int c = 0; c < DBM_CELLS; c++){
+      if(type[c] == FREE) cell[cells++] = c;
+    }
+  }
+
+  // solver passes over the free cells, A is the Laplacian with the channel
+  // and target cells as fixed values and no flow out of the domain
+  enum { RESIDUAL, PRODUCT, UPDATE, DIRECTION };
+
+  static void task(void* self, int chunk){
+    ((DbmGenerator*)self)->work(chunk);
+  }
+
+  void work(int chunk){
+    int begin = chunk * DBM_CHUNK;
+    int end = std::min(cells, begin + DBM_CHUNK);
+    double sum = 0;
+    for(int k = begin; k < end; k++){
+      int c = cell[k];
+      switch(pass){
+        case RESIDUAL: {
+          float r = 0;
+          for(int n = 0; n < 6; n++){
+            int m = neighbour(c, n);
+            if(type[m] != OUTSIDE) r += phi[m] - phi[c];
+          }
+          residual[c] = r;
+          direction[c] = r;
+          sum += r * r;
+          break;
+        }
+        case PRODUCT: {
+          float a = 0;
+          for(int n = 0; n < 6; n++){
+            int m = neighbour(c, n);
+            if(type[m] != OUTSIDE) a += direction[c] - direction[m];
+          }
+          product[c] = a;
+          sum += direction[c] * a;
+          break;
+        }
+        case UPDATE:
+          phi[c] += alpha * direction[c];
+          residual[c] -= alpha * product[c];
+          sum += residual[c] * residual[c];
+          break;
+        case DIRECTION:
+          direction[c] = residual[c] + beta * direction[c];
+          break;
+      }
+    }
+    chunkSum[chunk] = sum;
+  }
+
+  double run(int which){
+    pass = which;
+    int chunks = (cells + DBM_CHUNK - 1) / DBM_CHUNK;
+    if(threads && chunks > 1){
+      threads->run(chunks, task, this);
+    }else{
+      for(int chunk = 0; chunk < chunks; chunk++) work(chunk);
+    }
+    double sum = 0;
+    for(int chunk = 0; chunk < chunks; chunk++) sum += chunkSum[chunk];
+    return sum;
+  }
+
+  void solve(){
+    double rr = run(RESIDUAL);
+    for(int i = 0; i < DBM_ITERATIONS && rr > 1e-12; i++){
+      double pAp = run(PRODUCT);
+      if(pAp <= 0) break;
+      alpha = rr / pAp;
+      double next = run(UPDATE);
+      beta = next / rr;
+      rr = next;
+      run(DIRECTION);
+    }
+  }
+
+  // add up to DBM_GROWTH front cells, returns the one that reached the
+  // destination or -1
+  int grow(BoltRandom& rng){
+    int kept = 0;
+    double total = 0;
+    for(int f = 0; f < fronts; f++){
+      int c = front[f];
+      if(type[c] != FREE) continue;
+      front[kept] = c;
+      weight[kept] = pow(std::max(phi[c], 0.f), DBM_ETA);
+      total += weight[kept];
+      kept++;
+    }
+    fronts = kept;
+
+    for(int g = 0; g < DBM_GROWTH && fronts > 0; g++){
+      int pick = -1;
+      if(total > 0){
+        double r = rng.uniform() * total;
+        for(int f = 0; f < fronts; f++){
+          if(weight[f] <= 0) continue;
+          pick = f;  // the last candidate if rounding leaves r >= 0
+          r -= weight[f];
+          if(r < 0) break;
+        }
+      }
+      if(pick < 0){
+        pick = rng.next() % fronts;
+      }
+      int c = front[pick];
+      total -= weight[pick];
+      fronts--;
+      front[pick] = front[fronts];
+      weight[pick] = weight[fronts];
+      listed[c] = false;
+
+      int from = -1;
+      for(int n = 0; n < 6 && from < 0; n++){
+        int m = neighbour(c, n);
+        if(type[m] == CHANNEL) from = m;
+      }
+      addChannel(c, from);
+      if(touchesTarget(c)) return c;
+    }
+    return -1;
+  }
+
+  int closestToDest() const {
+    int best = grown[0];
+    for(int g = 1; g < channel; g++){
+      if((centerOf(grown[g]) - dest).mag() < (centerOf(best) - dest).mag()) best = grown[g];
+    }
+    return best;
+  }
+
+  // where a channel cell's point goes, jittered inside its cell by a stream
+  // of its own so a shared branch point lands on the same spot in every run
+  Vec3f pointOf(int c) const {
+    if(parent[c] < 0) return source;
+    BoltRandom jitter(BoltRandom::split(seed, c));
+    return centerOf(c) + Vec3f(jitter.uniformS(), jitter.uniformS(), jitter.uniformS()) * (0.35f * h);
+  }
+
+  // cells from c back to the first one already in a run, which is included
+  int trace(int c){
+    int count = 0;
+    while(c >= 0){
+      path[count++] = c;
+      if(listed[c]) break;
+      c = parent[c];
+    }
+    return count;
+  }
+
+  void layOut(BoltGenerator& out, int hit, float width, int branches, int budget){
+    for(int c = 0; c < DBM_CELLS; c++) listed[c] = false;
+
+    // main run, source to destination, thinned out if it doesn't fit
+    int count = trace(hit);
+    int stride = 1;
+    while((count + stride - 1) / stride > budget) stride++;
+    int segments = 0;
+    out.addRun(width);
+    for(int i = count - 1; i >= 0; i--){
+      listed[path[i]] = true;
+      if((count - 1 - i) % stride == 0){
+        out.addPoint(pointOf(path[i]), (float)(count - 1 - i) / count);
+      }
+    }
+    out.addPoint(dest, 1);
+    segments += out.run[out.runs - 1].count - 1;
+
+    // limbs ending in a leaf, longest first, become branches while they fit
+    int limbs = 0;
+    for(int g = 0; g < channel; g++){
+      int c = grown[g];
+      if(children[c] > 0 || listed[c]) continue;
+      int length = trace(c) - 1;
+      if(length >= 2) limb[limbs++] = (uint64_t)(DBM_CELLS - length) << 32 | (uint32_t)c;
+    }
+    std::sort(limb, limb + limbs);
+    for(int l = 0; l < limbs && branches > 0 && out.runs < MAX_BOLT_RUNS; l++){
+      int leaf = (int)(limb[l] & 0xffffffffu);
+      int length = trace(leaf) - 1;  // shorter if a longer limb took its base
+      if(length < 2 || segments + length > budget) continue;
+      out.addRun(width * 0.6f);
+      for(int i = length; i >= 0; i--){
+        listed[path[i]] = true;
+        out.addPoint(pointOf(path[i]), (float)(length - i) / length);
+      }
+      segments += length;
+      branches--;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,419 @@
+#ifndef __BOLT_GENERATOR__
+#define __BOLT_GENERATOR__
+
+// Bolt geometry generator
+//
+// A bolt is laid out first as a tree of polylines ("runs": the main bolt
+// and its branches) in fixed size structure-of-arrays buffers, and only then
+// turned into triangles. The tree is grown a level at a time instead of
+// recursing: every run of a level is laid out, then the branches those runs
+// offer are taken in tree order for as long as their segments fit the
+// budget, so the vertex count is known before any vertex is written and
+// nothing ever gets truncated.
+//
+// Runs of a level don't depend on each other. Each gets its points at a
+// fixed place in the buffers and a random stream keyed by its parent's seed
+// and the point it branches from, so with a BoltThreads pool a level is laid
+// out in parallel and the bolt is bit for bit the same on any number of
+// threads.
+//
+// Emitting writes an indexed mesh. Every point is two vertices (plus edge,
+// minus edge) shared by the segments on either side of it, and every run
+// indexes only its own vertices, so branches join their parent without
+// stitching. A RIBBON_FLAT mesh has the edges apart already: expand() moves
+// every point to both of them along its run's normal with a SIMD kernel
+// (bolt_ribbon.hpp). A RIBBON_FACING mesh keeps both at the point, with the
+// bolt's direction there as their normal, and whoever draws it moves them
+// apart across the line of sight, so a bolt seen end on doesn't thin away.
+//
+// Include after VERTEX_COUNT is defined (common_4.hpp does).
+
+#ifdef BOLT_HEADLESS
+#include "bolt_headless.hpp"
+#else
+#include "allocore/io/al_App.hpp"
+#endif
+#include <cmath>
+#include <stdint.h>
+#include "bolt_ribbon.hpp"
+#include "bolt_threads.hpp"
+
+// define before including to lay out bolts past VERTEX_COUNT, the benchmark does
+#ifndef MAX_BOLT_SEGMENTS
+#define MAX_BOLT_SEGMENTS (VERTEX_COUNT / 6)  // 6 indices per segment
+#endif
+#define MAX_BOLT_RUNS (MAX_BOLT_SEGMENTS)
+#define MAX_BOLT_POINTS (MAX_BOLT_SEGMENTS + MAX_BOLT_RUNS)
+
+// how emit() lays out a ribbon:
+//    RIBBON_FLAT both edges in place, facing along each run's fixed normal
+//    RIBBON_FACING both edges on the centre line, the normal is the unit
+//                  direction of the bolt times the half width, for
+//                  render_allosphere_4's vertex shader to expand toward the eye
+#define RIBBON_FLAT 0
+#define RIBBON_FACING 1
+
+// small deterministic random generator (xorshift64*)
+// rnd:: keeps one global state that a renderer can't replay, so every bolt
+// owns one of these seeded from its descriptor
+struct BoltRandom {
+  uint64_t s;
+
+  BoltRandom(uint64_t seed = 1){ reseed(seed); }
+
+  void reseed(uint64_t seed){
+    // splitmix64 so that neighbouring seeds start far apart
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    s = z ^ (z >> 31);
+    if(s == 0) s = 0x9E3779B97F4A7C15ULL;
+  }
+
+  uint32_t next(){
+    s ^= s >> 12;
+    s ^= s << 25;
+    s ^= s >> 27;
+    return (uint32_t)((s * 0x2545F4914F6CDD1DULL) >> 32);
+  }
+
+  // same ranges as rnd::uniform, rnd::uniformS and rnd::prob
+  float uniform(){ return (next() >> 8) * (1.f / 16777216.f); }
+  float uniformS(float scale = 1.f){ return (uniform() * 2.f - 1.f) * scale; }
+  bool prob(float p){ return uniform() < p; }
+
+  // seed of stream number counter under seed, a counter-based split that
+  // doesn't depend on how much of any other stream was used
+  static uint32_t split(uint32_t seed, uint32_t counter){
+    uint64_t z = ((uint64_t)seed << 32 | counter) + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (uint32_t)(z ^ (z >> 31));
+  }
+};
+
+class BoltGenerator {
+  public:
+  // one polyline of the bolt, its points are first .. first + count - 1
+  struct Run {
+    int first;
+    int count;
+    float width;
+    Vec3f normal;
+  };
+
+  // a run to be laid out, or a branch one offers
+  struct Job {
+    Vec3f source;
+    Vec3f dest;
+    int maxBranches;
+    float width;
+    int n;
+    uint32_t seed;
+    int first;   // where its points go
+    int offer;   // where the branches it offers go
+    int offers;  // and how many it offered
+  };
+
+  // points of every run
+  float x[MAX_BOLT_POINTS];
+  float y[MAX_BOLT_POINTS];
+  float z[MAX_BOLT_POINTS];
+  float t[MAX_BOLT_POINTS];  // tex coord along the run, 0..1
+  int points;
+
+  // both edges of the ribbon, point + normal * width and point - normal * width
+  float plusX[MAX_BOLT_POINTS], plusY[MAX_BOLT_POINTS], plusZ[MAX_BOLT_POINTS];
+  float minusX[MAX_BOLT_POINTS], minusY[MAX_BOLT_POINTS], minusZ[MAX_BOLT_POINTS];
+  RibbonKernel kernel;
+
+  Run run[MAX_BOLT_RUNS];
+  int runs;
+
+  // run[i] is laid out from job[i], a level is job[level .. jobs - 1]
+  Job job[MAX_BOLT_RUNS];
+  int jobs;
+  int level;
+
+  Job offer[MAX_BOLT_POINTS];
+  float position[MAX_BOLT_POINTS];  // scratch, at the same place as the points
+  int segments;       // segments handed out so far, branches included
+  int segmentBudget;
+  float branchProb;
+
+  // lays levels out in parallel when set, in place when 0
+  BoltThreads* threads;
+
+  BoltGenerator() : points(0), kernel(bestRibbonKernel()), runs(0), jobs(0), threads(0) {}
+
+  // the generator the app thread uses
+  static BoltGenerator& shared(){
+    static BoltGenerator generator;
+    return generator;
+  }
+
+  // lay out a bolt from source to dest, same parameters as Bolt::makeBolt
+  // returns the number of indices emit() will write, never more than budget
+  int generate(BoltRandom& rng, Vec3f source, Vec3f dest, int maxBranches,
+               float prob, float wid, int n, int budget = VERTEX_COUNT){
+    points = 0;
+    runs = 0;
+    jobs = 0;
+    level = 0;
+    branchProb = prob;
+    segmentBudget = std::min(budget / 6, MAX_BOLT_SEGMENTS);
+
+    float width = (wid > 0) ? wid : (dest - source).mag() / 25.0 + 0.01;
+    n = std::min(n, segmentBudget);
+    if(n < 1) return 0;
+
+    segments = 0;
+    Job main;
+    main.source = source;
+    main.dest = dest;
+    main.maxBranches = maxBranches;
+    main.width = width;
+    main.n = n;
+    main.seed = rng.next();
+    take(main);
+
+    while(level < jobs){
+      // room for every branch the runs of this level could offer
+      int offers = 0;
+      for(int j = level; j < jobs; j++){
+        job[j].offer = offers;
+        job[j].offers = 0;
+        offers += std::max(0, std::min(job[j].maxBranches, job[j].n - 1));
+      }
+
+      if(threads && jobs - level > 1){
+        threads->run(jobs - level, layOutTask, this);
+      }else{
+        for(int j = level; j < jobs; j++) layOut(j);
+      }
+
+      // branches are taken in tree order, whatever order they were laid out in
+      int end = jobs;
+      for(int j = level; j < end; j++){
+        for(int k = 0; k < job[j].offers; k++){
+          const Job& branch = offer[job[j].offer + k];
+          if(branch.n >= 2 && segments + branch.n <= segmentBudget){
+            take(branch);
+          }
+        }
+      }
+      level = end;
+    }
+    runs = jobs;
+    return indexCount();
+  }
+
+  // other layouts (bolt_dbm.hpp) fill the runs themselves: clear(), then
+  // for every run addRun() and its points with addPoint()
+  void clear(){
+    points = 0;
+    runs = 0;
+    jobs = 0;
+  }
+
+  void addRun(float width){
+    Run& r = run[runs++];
+    r.first = points;
+    r.count = 0;
+    r.width = width;
+    r.normal = Vec3f(1, 0, 0);
+  }
+
+  // the ribbon of a run faces the same way as a random walk run would
+  void addPoint(const Vec3f& p, float along){
+    Run& r = run[runs - 1];
+    setPoint(points++, p, along);
+    r.count++;
+    Vec3f tangent(x[points - 1] - x[r.first], y[points - 1] - y[r.first],
+                  z[points - 1] - z[r.first]);
+    Vec3f normal = tangent.cross(Vec3f(0, 0, -1));
+    if(normal.mag() > 1e-6f) r.normal = normal.normalize();
+  }
+
+  int vertexCount() const { return points * 2; }
+  int indexCount() const { return (points - runs) * 6; }
+
+  // move every point of the last generated bolt to both ribbon edges
+  void expand(){
+    for(int r = 0; r < runs; r++){
+      Vec3f offset = run[r].normal * run[r].width;
+      int first = run[r].first;
+      int count = run[r].count;
+      kernel(x + first, count, offset.x, plusX + first, minusX + first);
+      kernel(y + first, count, offset.y, plusY + first, minusY + first);
+      kernel(z + first, count, offset.z, plusZ + first, minusZ + first);
+    }
+  }
+
+  // append the last generated bolt to mesh as indexed triangles
+  void emit(Mesh& mesh, const Color& color, int ribbon = RIBBON_FLAT){
+    mesh.primitive(Graphics::TRIANGLES);
+    if(indexCount() == 0) return;
+
+    int base = mesh.vertices().size();
+    int count = vertexCount();
+    mesh.vertices().resize(base + count);
+    mesh.texCoord2s().resize(base + count);
+    mesh.colors().resize(base + count);
+    Vec3f* v = &mesh.vertices()[base];
+    Vec2f* tc = &mesh.texCoord2s()[base];
+    Color* c = &mesh.colors()[base];
+    if(ribbon == RIBBON_FACING){
+      mesh.normals().resize(base + count);
+      Vec3f* normal = &mesh.normals()[base];
+      for(int r = 0; r < runs; r++){
+        int first = run[r].first;
+        int last = first + run[r].count - 1;
+        for(int k = first; k <= last; k++){
+          Vec3f p(x[k], y[k], z[k]);
+          v[2 * k] = v[2 * k + 1] = p;
+          normal[2 * k] = normal[2 * k + 1] = direction(k, first, last) * run[r].width;
+        }
+      }
+    }else{
+      expand();
+      for(int k = 0; k < points; k++){
+        v[2 * k] = Vec3f(plusX[k], plusY[k], plusZ[k]);
+        v[2 * k + 1] = Vec3f(minusX[k], minusY[k], minusZ[k]);
+      }
+    }
+    for(int k = 0; k < points; k++){
+      tc[2 * k] = Vec2f(0, t[k]);
+      tc[2 * k + 1] = Vec2f(1, t[k]);
+      c[2 * k] = color;
+      c[2 * k + 1] = color;
+    }
+
+    int first = mesh.indices().size();
+    mesh.indices().resize(first + indexCount());
+    Mesh::Index* index = &mesh.indices()[first];
+    for(int r = 0; r < runs; r++){
+      int last = run[r].first + run[r].count - 1;
+      for(int k = run[r].first; k < last; k++){
+        Mesh::Index a = base + 2 * k;  // plus edge of k, minus edge is a + 1
+        index[0] = a;
+        index[1] = a + 1;
+        index[2] = a + 2;
+        index[3] = a + 2;
+        index[4] = a + 1;
+        index[5] = a + 3;
+        index += 6;
+      }
+    }
+  }
+
+  // unit direction of the run first .. last at point k, from its neighbours
+  Vec3f direction(int k, int first, int last) const {
+    int a = k > first ? k - 1 : k;
+    int b = k < last ? k + 1 : k;
+    Vec3f d(x[b] - x[a], y[b] - y[a], z[b] - z[a]);
+    float length = d.mag();
+    return length > 1e-9f ? d / length : Vec3f(1, 0, 0);
+  }
+
+  private:
+  // give a run its points and a place in the tree
+  void take(const Job& j){
+    Job& taken = job[jobs++];
+    taken = j;
+    taken.first = points;
+    points += j.n + 1;
+    segments += j.n;
+  }
+
+  static void layOutTask(void* self, int task){
+    BoltGenerator* generator = (BoltGenerator*)self;
+    generator->layOut(generator->level + task);
+  }
+
+  void setPoint(int k, const Vec3f& p, float along){
+    x[k] = p.x;
+    y[k] = p.y;
+    z[k] = p.z;
+    t[k] = along;
+  }
+
+  // random walk along run j, modified from Michael Hoffman's
+  // (http://gamedevelopment.tutsplus.com/tutorials/how-to-generate-shockingly-good-2d-lightning-effects--gamedev-2681)
+  // only touches its own points, run and offers, so runs can be laid out at once
+  void layOut(int j){
+    Job& self = job[j];
+    BoltRandom rng(self.seed);
+    int n = self.n;
+    int first = self.first;
+    float* position = this->position + first;
+    Vec3f tangent = (self.dest - self.source);  // direction of lightning
+    Vec3f normal =
+        tangent.cross(Vec3f(0, 0, -1)).normalize();  // normal to lightning
+    float length = tangent.mag();
+
+    // n sorted random positions (0,1) along the lightning vector without a
+    // sort: running sums of exponential gaps, divided by the total, are
+    // distributed like sorted uniforms
+    double sum = 0;
+    position[0] = 0;
+    for (int i = 1; i <= n; i++) {
+      sum -= std::log(1.0 - rng.uniform());
+      position[i] = sum;
+    }
+    sum -= std::log(1.0 - rng.uniform());
+    float inverse = 1 / sum;
+    for (int i = 1; i <= n; i++) position[i] *= inverse;
+
+    float sway = 1;  // max random walk step of displacement along normal
+    float jaggedness = 1 / sway;
+    float prevDisplacement = 0;
+    int branches = 0;
+
+    Run& r = run[j];
+    r.first = first;
+    r.count = n + 1;
+    r.width = self.width;
+    r.normal = normal;
+
+    setPoint(first, self.source, 0);
+    for (int i = 1; i < n; i++) {
+      float pos = position[i];
+
+      // used to prevent sharp angles by ensuring very close positions also have
+      // small perpendicular variation.
+      float scale = (length * jaggedness) * (pos - position[i - 1]);
+
+      // defines an envelope. Points near the middle of the bolt can be further
+      // from the central line.
+      float envelope = pos > 0.95f ? mapRange(pos, 0.95f, 1.0f, 1.0f, 0.0f) : 1;
+
+      // displacement from prevDisplacement (random walk (brownian motion))
+      float displacement = rng.uniformS(sway) * scale + prevDisplacement;
+      displacement *= envelope;
+
+      Vec3f point = self.source + pos * tangent + displacement * normal;
+      setPoint(first + i, point, (float)i / n);
+
+      if (branches < self.maxBranches && rng.prob(branchProb)) {
+        branches++;
+        Vec3f dir(tangent);
+        rotate(dir, Vec3f(0, 0, 1), rng.uniformS(30) * M_DEG2RAD);
+        dir.normalize();
+        float len = (self.dest - point).mag();
+        // whether it is taken is up to generate(), once the level is done
+        Job& branch = offer[self.offer + self.offers++];
+        branch.source = point;
+        branch.dest = point + dir * len * 0.4;
+        branch.maxBranches = self.maxBranches - 1;
+        branch.width = self.width * 0.6;
+        branch.n = n * 0.5;
+        branch.seed = BoltRandom::split(self.seed, i);
+      }
+      prevDisplacement = displacement;
+    }
+    setPoint(first + n, self.dest, 1);
+  }
+};
+
+#endif
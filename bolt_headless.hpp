@@ -0,0 +1,312 @@
+#ifndef __BOLT_HEADLESS__
+#define __BOLT_HEADLESS__
+
+// Stand-in for the parts of allocore the bolt code uses
+//
+// Building with BOLT_HEADLESS defined makes common_4.hpp include this
+// instead of allocore/io/al_App.hpp, so the bolt pipeline (generation,
+// fade and bulge, State packing and unpacking) builds and runs with nothing
+// but a C++11 compiler: no window, no GL, no audio, no network. Only the
+// vector, colour and mesh types are here, and they behave like allocore's:
+// Buffer keeps its capacity through reset() and resize(), so allocation
+// counts match the real thing. Nothing here draws.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+#define M_DEG2RAD (M_PI / 180.0)
+
+namespace al {
+
+// components by name, as allocore has them
+template <int N, class T> struct VecData;
+template <class T> struct VecData<2, T> { T x, y; };
+template <class T> struct VecData<3, T> { T x, y, z; };
+template <class T> struct VecData<4, T> { T x, y, z, w; };
+
+template <int N, class T>
+struct Vec : VecData<N, T> {
+  Vec(){ set(0, 0, 0, 0); }
+  Vec(T a){ set(a, a, a, a); }
+  Vec(T a, T b){ set(a, b, 0, 0); }
+  Vec(T a, T b, T c){ set(a, b, c, 0); }
+  Vec(T a, T b, T c, T d){ set(a, b, c, d); }
+  template <class U>
+  Vec(const Vec<N, U>& v){ for(int i = 0; i < N; i++) (*this)[i] = v[i]; }
+
+  T& operator[](int i){ return (&this->x)[i]; }
+  const T& operator[](int i) const { return (&this->x)[i]; }
+
+  Vec operator+(const Vec& v) const { Vec r; for(int i = 0; i < N; i++) r[i] = (*this)[i] + v[i]; return r; }
+  Vec operator-(const Vec& v) const { Vec r; for(int i = 0; i < N; i++) r[i] = (*this)[i] - v[i]; return r; }
+  Vec operator*(const Vec& v) const { Vec r; for(int i = 0; i < N; i++) r[i] = (*this)[i] * v[i]; return r; }
+  Vec operator*(T s) const { Vec r; for(int i = 0; i < N; i++) r[i] = (*this)[i] * s; return r; }
+  Vec operator/(T s) const { Vec r; for(int i = 0; i < N; i++) r[i] = (*this)[i] / s; return r; }
+  Vec operator-() const { Vec r; for(int i = 0; i < N; i++) r[i] = -(*this)[i]; return r; }
+  Vec& operator+=(const Vec& v){ for(int i = 0; i < N; i++) (*this)[i] += v[i]; return *this; }
+  Vec& operator-=(const Vec& v){ for(int i = 0; i < N; i++) (*this)[i] -= v[i]; return *this; }
+  Vec& operator*=(T s){ for(int i = 0; i < N; i++) (*this)[i] *= s; return *this; }
+  bool operator==(const Vec& v) const { for(int i = 0; i < N; i++) if((*this)[i] != v[i]) return false; return true; }
+  bool operator!=(const Vec& v) const { return !(*this == v); }
+
+  T dot(const Vec& v) const { T s = 0; for(int i = 0; i < N; i++) s += (*this)[i] * v[i]; return s; }
+  T mag() const { return std::sqrt(dot(*this)); }
+  T magSqr() const { return dot(*this); }
+  Vec& normalize(T scale = 1){
+    T m = mag();
+    if(m > 0) *this *= scale / m;
+    return *this;
+  }
+  Vec cross(const Vec& b) const {
+    const Vec& a = *this;
+    return Vec(a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]);
+  }
+
+  private:
+  void set(T a, T b, T c, T d){
+    T v[4] = {a, b, c, d};
+    for(int i = 0; i < N; i++) (*this)[i] = v[i];
+  }
+};
+
+template <int N, class T>
+Vec<N, T> operator*(T s, const Vec<N, T>& v){ return v * s; }
+
+template <int N, class T>
+std::ostream& operator<<(std::ostream& o, const Vec<N, T>& v){
+  o << "{";
+  for(int i = 0; i < N; i++) o << (i ? ", " : "") << v[i];
+  return o << "}";
+}
+
+typedef Vec<2, float> Vec2f;
+typedef Vec<3, float> Vec3f;
+typedef Vec<4, float> Vec4f;
+typedef Vec<3, double> Vec3d;
+
+// rotate v about axis (unit length) by angle radians
+template <class T>
+void rotate(Vec<3, T>& v, const Vec<3, T>& axis, double angle){
+  T c = std::cos(angle), s = std::sin(angle);
+  v = v * c + axis.cross(v) * s + axis * (axis.dot(v) * (1 - c));
+}
+
+template <class T>
+T mapRange(T value, T inLow, T inHigh, T outLow, T outHigh){
+  return outLow + (value - inLow) / (inHigh - inLow) * (outHigh - outLow);
+}
+
+struct HSV {
+  float h, s, v;
+  HSV(float h, float s, float v) : h(h), s(s), v(v) {}
+};
+
+struct Color {
+  float r, g, b, a;
+  Color(float gray = 1, float a = 1) : r(gray), g(gray), b(gray), a(a) {}
+  Color(float r, float g, float b, float a = 1) : r(r), g(g), b(b), a(a) {}
+  Color(const HSV& hsv, float a = 1) : a(a) {
+    float h = (hsv.h - std::floor(hsv.h)) * 6;
+    int sector = (int)h;
+    float f = h - sector;
+    float p = hsv.v * (1 - hsv.s);
+    float q = hsv.v * (1 - hsv.s * f);
+    float t = hsv.v * (1 - hsv.s * (1 - f));
+    switch(sector){
+      case 0: r = hsv.v; g = t; b = p; break;
+      case 1: r = q; g = hsv.v; b = p; break;
+      case 2: r = p; g = hsv.v; b = t; break;
+      case 3: r = p; g = q; b = hsv.v; break;
+      case 4: r = t; g = p; b = hsv.v; break;
+      default: r = hsv.v; g = p; b = q; break;
+    }
+  }
+  // allocore scales every component, alpha included
+  Color operator*(float s) const { return Color(r * s, g * s, b * s, a * s); }
+};
+
+template <class T>
+struct Quat {
+  T w, x, y, z;
+  Quat(T w = 1, T x = 0, T y = 0, T z = 0) : w(w), x(x), y(y), z(z) {}
+
+  // the rotated unit axes
+  Vec<3, T> toVectorX() const { return Vec<3, T>(1 - 2 * (y * y + z * z), 2 * (x * y + w * z), 2 * (x * z - w * y)); }
+  Vec<3, T> toVectorY() const { return Vec<3, T>(2 * (x * y - w * z), 1 - 2 * (x * x + z * z), 2 * (y * z + w * x)); }
+  Vec<3, T> toVectorZ() const { return Vec<3, T>(2 * (x * z + w * y), 2 * (y * z - w * x), 1 - 2 * (x * x + y * y)); }
+
+  // like allocore's, the short way round, amt beyond 1 carries on
+  static Quat slerp(const Quat& a, const Quat& b, T amt){
+    T c = a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+    T sign = 1;
+    if(c < 0){
+      c = -c;
+      sign = -1;
+    }
+    T fa = 1 - amt, fb = amt;
+    if(c < 0.9995){
+      T angle = std::acos(c), s = std::sin(angle);
+      fa = std::sin(fa * angle) / s;
+      fb = std::sin(fb * angle) / s;
+    }
+    fb *= sign;
+    Quat q(fa * a.w + fb * b.w, fa * a.x + fb * b.x, fa * a.y + fb * b.y, fa * a.z + fb * b.z);
+    T n = std::sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+    return Quat(q.w / n, q.x / n, q.y / n, q.z / n);
+  }
+};
+typedef Quat<double> Quatd;
+
+struct Pose {
+  Vec3d mVec;
+  Quatd mQuat;
+  Pose(){}
+  Pose(const Vec3d& v, const Quatd& q = Quatd()) : mVec(v), mQuat(q) {}
+  Vec3d& pos(){ return mVec; }
+  const Vec3d& pos() const { return mVec; }
+  Quatd& quat(){ return mQuat; }
+  const Quatd& quat() const { return mQuat; }
+  Vec3d ur() const { return mQuat.toVectorX(); }
+  Vec3d uu() const { return mQuat.toVectorY(); }
+  Vec3d uf() const { return -mQuat.toVectorZ(); }
+};
+
+// growable array that, like allocore's, keeps its storage when emptied
+template <class T>
+class Buffer {
+  public:
+  int size() const { return (int)mElems.size(); }
+  T& operator[](int i){ return mElems[i]; }
+  const T& operator[](int i) const { return mElems[i]; }
+  void reset(){ mElems.clear(); }
+  void resize(int n){ mElems.resize(n); }
+  void append(const T& v){ mElems.push_back(v); }
+  void append(const T* src, int n){ mElems.insert(mElems.end(), src, src + n); }
+
+  private:
+  std::vector<T> mElems;
+};
+
+struct Graphics {
+  enum Primitive { POINTS, LINES, LINE_STRIP, TRIANGLES, TRIANGLE_STRIP };
+  enum Format { LUMINANCE_ALPHA, RGBA };
+  enum DataType { UBYTE, FLOAT };
+};
+
+class Mesh {
+  public:
+  typedef unsigned int Index;
+
+  Mesh() : mPrimitive(Graphics::TRIANGLES) {}
+
+  Mesh& primitive(int p){ mPrimitive = p; return *this; }
+  int primitive() const { return mPrimitive; }
+
+  Mesh& vertex(const Vec3f& v){ mVertices.append(v); return *this; }
+  Mesh& normal(const Vec3f& n){ mNormals.append(n); return *this; }
+  Mesh& color(const Color& c){ mColors.append(c); return *this; }
+  Mesh& texCoord(float u, float v){ mTexCoord2s.append(Vec2f(u, v)); return *this; }
+  Mesh& index(Index i){ mIndices.append(i); return *this; }
+
+  Buffer<Vec3f>& vertices(){ return mVertices; }
+  const Buffer<Vec3f>& vertices() const { return mVertices; }
+  Buffer<Vec3f>& normals(){ return mNormals; }
+  const Buffer<Vec3f>& normals() const { return mNormals; }
+  Buffer<Color>& colors(){ return mColors; }
+  const Buffer<Color>& colors() const { return mColors; }
+  Buffer<Vec2f>& texCoord2s(){ return mTexCoord2s; }
+  const Buffer<Vec2f>& texCoord2s() const { return mTexCoord2s; }
+  Buffer<Index>& indices(){ return mIndices; }
+  const Buffer<Index>& indices() const { return mIndices; }
+
+  void reset(){
+    mVertices.reset();
+    mNormals.reset();
+    mColors.reset();
+    mTexCoord2s.reset();
+    mIndices.reset();
+  }
+
+  // a sphere's vertices are their own normals
+  void generateNormals(){
+    mNormals.reset();
+    for(int i = 0; i < mVertices.size(); i++){
+      Vec3f n = mVertices[i];
+      mNormals.append(n.normalize());
+    }
+  }
+
+  private:
+  int mPrimitive;
+  Buffer<Vec3f> mVertices;
+  Buffer<Vec3f> mNormals;
+  Buffer<Color> mColors;
+  Buffer<Vec2f> mTexCoord2s;
+  Buffer<Index> mIndices;
+};
+
+// latitude-longitude sphere, indexed triangles
+inline int addSphere(Mesh& m, double radius = 1, int slices = 16, int stacks = 16){
+  int first = m.vertices().size();
+  for(int j = 0; j <= stacks; j++){
+    double theta = M_PI * j / stacks;
+    for(int i = 0; i <= slices; i++){
+      double phi = 2 * M_PI * i / slices;
+      m.vertex(Vec3f(radius * std::sin(theta) * std::cos(phi), radius * std::cos(theta),
+                     radius * std::sin(theta) * std::sin(phi)));
+    }
+  }
+  for(int j = 0; j < stacks; j++){
+    for(int i = 0; i < slices; i++){
+      Mesh::Index a = first + j * (slices + 1) + i;
+      Mesh::Index b = a + slices + 1;
+      m.index(a); m.index(b); m.index(a + 1);
+      m.index(a + 1); m.index(b); m.index(b + 1);
+    }
+  }
+  return (slices + 1) * (stacks + 1);
+}
+
+// pixels of a texture, one byte per component
+class Array {
+  public:
+  Array(int width = 0, int height = 0, int components = 1)
+    : mWidth(width), mHeight(height), mComponents(components),
+      mData(width * height * components) {}
+  size_t width() const { return mWidth; }
+  size_t height() const { return mHeight; }
+  void write(const uint8_t* src, int col, int row){
+    memcpy(&mData[(row * mWidth + col) * mComponents], src, mComponents);
+  }
+
+  private:
+  int mWidth, mHeight, mComponents;
+  std::vector<uint8_t> mData;
+};
+
+// holds the pixels only, there is nothing to upload them to
+class Texture {
+  public:
+  Texture(){}
+  Texture(int width, int height, int format, int /* type */, bool /* clamp */)
+    : mArray(width, height, format == Graphics::LUMINANCE_ALPHA ? 2 : 4) {}
+  Array& array(){ return mArray; }
+  void bind(){}
+  void unbind(){}
+
+  private:
+  Array mArray;
+};
+
+}  // al::
+
+#endif
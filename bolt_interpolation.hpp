@@ -0,0 +1,143 @@
+#ifndef __BOLT_INTERPOLATION__
+#define __BOLT_INTERPOLATION__
+
+// Drawing between States
+//
+// A renderer that snaps to every State it takes shows each late or lost
+// broadcast as a hitch, and a simulator broadcasting at 30 Hz as judder on
+// a 60 Hz display. StateHistory keeps the last few States' times, poses
+// and nucleus positions and gives the renderer, for any moment on its own
+// clock, the simulator time to animate the bolts at and the pose and
+// nucleus to draw with: interpolated between the two States either side,
+// the rotation slerped, or carried on past the newest one for at most
+// MAX_EXTRAPOLATION seconds when the next is late, then held.
+//
+// The renderer draws delay() behind the newest State, one and a half
+// times the usual gap between States, so the State after the moment
+// drawn has normally arrived already. The simulator clock is tracked as
+// an offset from the renderer's, from the States that arrived soonest.
+// Fade and bulges follow from the time, so they come out smooth as well.
+//
+// Include after State (common_4.hpp does).
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#define STATE_HISTORY (8)           // States kept
+#define MAX_EXTRAPOLATION (0.1)     // seconds to carry on past the newest State
+
+// the renderer's clock, seconds from some moment that doesn't change
+inline double steadySeconds(){
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class StateHistory {
+  public:
+  // frames drawn each way since the last clearCounts()
+  int interpolated, extrapolated, held;
+
+  StateHistory() : count(0), newest(-1), offset(0), interval(1 / ANIMATION_RATE), arrived(0), shown(0) {
+    clearCounts();
+  }
+
+  void clearCounts(){ interpolated = extrapolated = held = 0; }
+
+  // the seconds the renderer draws behind the newest State
+  double delay() const { return std::min(std::max(1.5 * interval, 0.005), 0.2); }
+
+  // state arrived at now, in seconds on the renderer's clock
+  void add(const State& state, double now){
+    if(count > 0){
+      double last = sample[newest].time;
+      if(state.time < last - 1){
+        count = 0;  // the simulator restarted, or a replay went round
+        shown = 0;
+      }else if(state.time <= last){
+        return;     // a repeat
+      }
+    }
+    if(count > 0){
+      // a dropout isn't the usual gap, a change of rate soon shows
+      interval += 0.1 * (std::min(now - arrived, 2 * interval) - interval);
+    }
+    arrived = now;
+    // a late State makes the offset smaller, so take the largest and let
+    // it drift back slowly in case the clocks do
+    double o = state.time - now;
+    if(count == 0 || o > offset) offset = o;
+    else offset += 0.02 * (o - offset);
+
+    newest = (newest + 1) % STATE_HISTORY;
+    sample[newest].time = state.time;
+    sample[newest].pose = state.pose;
+    sample[newest].nucleusPose = state.nucleusPose;
+    count = std::min(count + 1, STATE_HISTORY);
+  }
+
+  // what to draw at now on the renderer's clock. false before any State
+  bool at(double now, double& time, Pose& pose, Vec3f& nucleusPose){
+    if(count == 0) return false;
+    // never back, the bolts would fade in again
+    double t = std::max(now + offset - delay(), shown);
+    shown = t;
+    const Sample& last = sample[newest];
+    if(t >= last.time){
+      if(count == 1){
+        held++;
+        set(last, last, 0, time, pose, nucleusPose);
+        return true;
+      }
+      const Sample& before = sample[(newest + STATE_HISTORY - 1) % STATE_HISTORY];
+      double ahead = t - last.time;
+      if(ahead > MAX_EXTRAPOLATION){
+        ahead = MAX_EXTRAPOLATION;
+        held++;
+      }else{
+        extrapolated++;
+      }
+      set(before, last, 1 + ahead / (last.time - before.time), time, pose, nucleusPose);
+      return true;
+    }
+    // newest first, for the latest State no later than t
+    for(int k = 1; k < count; k++){
+      const Sample& a = sample[(newest + STATE_HISTORY - k) % STATE_HISTORY];
+      const Sample& b = sample[(newest + STATE_HISTORY - k + 1) % STATE_HISTORY];
+      if(a.time <= t){
+        interpolated++;
+        set(a, b, (t - a.time) / (b.time - a.time), time, pose, nucleusPose);
+        return true;
+      }
+    }
+    // older than anything kept
+    const Sample& oldest = sample[(newest + STATE_HISTORY - count + 1) % STATE_HISTORY];
+    held++;
+    set(oldest, oldest, 0, time, pose, nucleusPose);
+    return true;
+  }
+
+  private:
+  struct Sample {
+    double time;
+    Pose pose;
+    Vec3f nucleusPose;
+  };
+  Sample sample[STATE_HISTORY];  // a ring, newest at newest
+  int count;
+  int newest;
+  double offset;    // simulator time minus renderer time
+  double interval;  // usual seconds between States
+  double arrived;   // when the newest came
+  double shown;     // simulator time of the last at()
+
+  // a + (b - a) * f, f beyond 1 extrapolates
+  static void set(const Sample& a, const Sample& b, double f,
+                  double& time, Pose& pose, Vec3f& nucleusPose){
+    time = a.time + (b.time - a.time) * f;
+    pose = Pose(a.pose.pos() + (b.pose.pos() - a.pose.pos()) * f,
+                Quatd::slerp(a.pose.quat(), b.pose.quat(), f));
+    nucleusPose = a.nucleusPose + (b.nucleusPose - a.nucleusPose) * (float)f;
+  }
+};
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef __BOLT_PROFILER__
+#define __BOLT_PROFILER__
+
+// Frame phase timers
+//
+// PROFILE("pack") at the top of a block times the rest of the block as the
+// phase "pack". Each thread writes its timings into a ring of its own, the
+// last PROFILE_EVENTS of them, and is the only writer of that ring, so a
+// timer costs two clock reads and a few stores with no locks. The ring's
+// count works as a seqlock: readers copy the newest half of a ring, then
+// read the count again and drop the events the thread may have started
+// overwriting meanwhile, so a copy never holds a torn event. The slots
+// are atomics stored with release and loaded with acquire, plain moves on
+// x86, so the race is one the language and TSan know about.
+//
+// writeTrace() saves every ring as Chrome trace JSON, for chrome://tracing
+// or Perfetto. With BOLT_TRACE=file in the environment, traceOnExit() makes
+// the program save one when it exits. ProfileHud summarizes the phases as
+// p50 and p99 bars to draw in front of the viewer.
+//
+// Build with BOLT_PROFILE 0 to compile the timers out.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#ifndef BOLT_PROFILE
+#define BOLT_PROFILE 1
+#endif
+#define PROFILE_EVENTS (4096)  // timings kept per thread
+#define MAX_PROFILE_THREADS (8)
+#define MAX_PROFILE_PHASES (32)
+
+struct ProfileEvent {
+  const char* phase;  // a string literal, phases are told apart by address
+  uint64_t begin;     // ns since the profiler started
+  uint64_t end;
+};
+
+// a ProfileEvent in a ring, read by other threads while its own writes it
+struct ProfileSlot {
+  std::atomic<const char*> phase;
+  std::atomic<uint64_t> begin;
+  std::atomic<uint64_t> end;
+};
+
+struct ProfileRing {
+  ProfileSlot event[PROFILE_EVENTS];
+  std::atomic<uint64_t> written;  // events ever recorded, only its thread adds
+  std::atomic<const char*> name;
+
+  ProfileRing() : written(0), name(0) {}
+};
+
+class Profiler {
+  public:
+  static Profiler& shared(){
+    static Profiler profiler;
+    return profiler;
+  }
+
+  uint64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start).count();
+  }
+
+  void record(const char* phase, uint64_t begin, uint64_t end){
+    ProfileRing* r = mine();
+    if(!r) return;
+    uint64_t w = r->written.load(std::memory_order_relaxed);
+    ProfileSlot& e = r->event[w % PROFILE_EVENTS];
+    // a reader that sees any of these stores also sees written at w
+    e.phase.store(phase, std::memory_order_release);
+    e.begin.store(begin, std::memory_order_release);
+    e.end.store(end, std::memory_order_release);
+    r->written.store(w + 1, std::memory_order_release);
+  }
+
+  // what the trace calls this thread
+  void nameThread(const char* name){
+    if(ProfileRing* r = mine()) r->name.store(name, std::memory_order_relaxed);
+  }
+
+  int threads() const { return std::min((int)taken.load(), MAX_PROFILE_THREADS); }
+
+  const char* threadName(int t) const { return ring[t].name.load(std::memory_order_relaxed); }
+
+  // the newest events of thread t, oldest first, at most PROFILE_EVENTS / 2
+  int snapshot(int t, ProfileEvent* out) const {
+    const ProfileRing& r = ring[t];
+    uint64_t w = r.written.load(std::memory_order_acquire);
+    uint64_t first = w > PROFILE_EVENTS / 2 ? w - PROFILE_EVENTS / 2 : 0;
+    int count = 0;
+    for(uint64_t i = first; i < w; i++){
+      const ProfileSlot& e = r.event[i % PROFILE_EVENTS];
+      out[count].phase = e.phase.load(std::memory_order_acquire);
+      out[count].begin = e.begin.load(std::memory_order_acquire);
+      out[count].end = e.end.load(std::memory_order_acquire);
+      count++;
+    }
+    // event i's slot is rewritten from when written reaches i + PROFILE_EVENTS
+    uint64_t now = r.written.load(std::memory_order_relaxed);
+    uint64_t torn = now >= PROFILE_EVENTS ? now - PROFILE_EVENTS + 1 : 0;
+    if(torn > first){
+      int dropped = (int)std::min<uint64_t>(torn - first, count);
+      count -= dropped;
+      std::copy(out + dropped, out + dropped + count, out);
+    }
+    return count;
+  }
+
+  bool writeTrace(const char* path) const {
+    FILE* file = fopen(path, "w");
+    if(!file) return false;
+    static ProfileEvent event[PROFILE_EVENTS / 2];
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    for(int t = 0; t < threads(); t++){
+      if(const char* name = threadName(t)){
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", t, name);
+        first = false;
+      }
+      int count = snapshot(t, event);
+      for(int i = 0; i < count; i++){
+        fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f}", first ? "" : ",\n", event[i].phase, t,
+                event[i].begin / 1000.0, (event[i].end - event[i].begin) / 1000.0);
+        first = false;
+      }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+  }
+
+  // save a trace to $BOLT_TRACE when the program exits, if it is set
+  static void traceOnExit(){
+    if(getenv("BOLT_TRACE")) atexit(writeExitTrace);
+  }
+
+  private:
+  std::chrono::steady_clock::time_point start;
+  ProfileRing ring[MAX_PROFILE_THREADS];
+  std::atomic<int> taken;
+
+  Profiler() : start(std::chrono::steady_clock::now()), taken(0) {}
+
+  // this thread's ring, handed out the first time it records. once they are
+  // all taken further threads go untimed
+  ProfileRing* mine(){
+    static thread_local ProfileRing* r = 0;
+    static thread_local bool asked = false;
+    if(!asked){
+      asked = true;
+      int t = taken++;
+      if(t < MAX_PROFILE_THREADS) r = &ring[t];
+    }
+    return r;
+  }
+
+  static void writeExitTrace(){
+    const char* path = getenv("BOLT_TRACE");
+    if(path && shared().writeTrace(path)) printf("trace written to %s\n", path);
+  }
+};
+
+// times from construction to the end of the enclosing block
+class ProfileScope {
+  public:
+  explicit ProfileScope(const char* phase) : phase(phase), begin(Profiler::shared().now()) {}
+  ~ProfileScope(){ Profiler::shared().record(phase, begin, Profiler::shared().now()); }
+
+  private:
+  const char* phase;
+  uint64_t begin;
+};
+
+#define PROFILE_JOIN(a, b) a##b
+#define PROFILE_NAME(a, b) PROFILE_JOIN(a, b)
+#if BOLT_PROFILE
+#define PROFILE(phase) ProfileScope PROFILE_NAME(profileScope, __LINE__)(phase)
+#define PROFILE_THREAD(name) Profiler::shared().nameThread(name)
+#else
+#define PROFILE(phase)
+#define PROFILE_THREAD(name)
+#endif
+
+// p50 and p99 of every phase over the last second, as one bar per phase
+// in front of the viewer: the bright part is p50, the dim part reaches
+// p99, and a whole bar is one frame at ANIMATION_RATE. every update also
+// prints the numbers, which the bars can't
+class ProfileHud {
+  public:
+  bool visible;
+  Mesh mesh;  // LINES, rebuilt by build()
+  int phases;
+  const char* phase[MAX_PROFILE_PHASES];
+  float p50[MAX_PROFILE_PHASES];  // ms
+  float p99[MAX_PROFILE_PHASES];
+
+  ProfileHud() : visible(false), phases(0), due(0) {
+    mesh.primitive(Graphics::LINES);
+  }
+
+  // recompute the percentiles, at most once a second. a phase keeps its
+  // row once it has shown up
+  void update(){
+    Profiler& profiler = Profiler::shared();
+    uint64_t now = profiler.now();
+    if(!visible || now < due) return;
+    due = now + 1000000000ull;
+
+    static ProfileEvent event[PROFILE_EVENTS / 2];
+    static Sample sample[MAX_PROFILE_THREADS * PROFILE_EVENTS / 2];
+    int samples = 0;
+    for(int t = 0; t < profiler.threads(); t++){
+      int count = profiler.snapshot(t, event);
+      for(int i = 0; i < count; i++){
+        if(now - event[i].end > 1000000000ull) continue;
+        int p = 0;
+        while(p < phases && phase[p] != event[i].phase) p++;
+        if(p == phases){
+          if(phases == MAX_PROFILE_PHASES) continue;
+          phase[phases++] = event[i].phase;
+        }
+        sample[samples].phase = p;
+        sample[samples].ms = (event[i].end - event[i].begin) / 1e6f;
+        samples++;
+      }
+    }
+    std::sort(sample, sample + samples);
+    for(int s = 0, p = 0; p < phases; p++){
+      int first = s;
+      while(s < samples && sample[s].phase == p) s++;
+      int count = s - first;
+      if(count == 0){
+        p50[p] = p99[p] = 0;
+        continue;
+      }
+      p50[p] = sample[first + count / 2].ms;
+      p99[p] = sample[first + std::min(count - 1, count * 99 / 100)].ms;
+      printf("%-16s p50 %7.3f ms  p99 %7.3f ms  (%d)\n", phase[p], p50[p], p99[p], count);
+    }
+    printf("\n");
+  }
+
+  // bars a metre in front of eye, from the upper left of the view
+  void build(const Pose& eye){
+    mesh.reset();
+    if(!visible) return;
+    Vec3f right = eye.ur(), up = eye.uu(), forward = eye.uf();
+    Vec3f corner = Vec3f(eye.pos()) + forward - right * 0.5f + up * 0.35f;
+    float frame = 1000.0 / ANIMATION_RATE;
+    for(int p = 0; p < phases; p++){
+      Vec3f row = corner - up * (0.025f * p);
+      Color hue = Color(HSV(fmod(p * 0.618f, 1.f), 0.7, 1));
+      float median = std::min(p50[p] / frame, 1.f) * 0.6f;
+      float tail = std::min(p99[p] / frame, 1.f) * 0.6f;
+      mesh.vertex(row);
+      mesh.vertex(row + right * median);
+      mesh.vertex(row + right * median);
+      mesh.vertex(row + right * std::max(tail, median));
+      mesh.color(hue);
+      mesh.color(hue);
+      mesh.color(hue * 0.4f);
+      mesh.color(hue * 0.4f);
+    }
+  }
+
+  private:
+  struct Sample {
+    int phase;
+    float ms;
+    bool operator<(const Sample& s) const {
+      return phase != s.phase ? phase < s.phase : ms < s.ms;
+    }
+  };
+  uint64_t due;  // when update() next recomputes
+};
+
+#endif
@@ -0,0 +1,389 @@
+#ifndef __BOLT_RECORDING__
+#define __BOLT_RECORDING__
+
+// Recorded State streams
+//
+// StateRecorder appends every State the simulator sends to a file, and
+// StateReplay plays one back in place of cuttlebone::Taker<State>, so a
+// renderer can run without a simulator, an interface server or PhaseSpace:
+// the same frames every run for performance tests, or the frames around a
+// hitch after a show.
+//
+// A recording is a header and then one record per frame, a RecordedFrame
+// followed by the part of the State that was in use (see encodeState), so
+// a frame with a few bolts takes a few hundred bytes rather than
+// sizeof(State). Records are only ever appended. Next to it, path.index
+// gets a RecordingIndexEntry per frame saying where its record starts; a
+// reader maps both files and seeks by frame number or by time through the
+// index. If the index is missing or short, after a crash say, the reader
+// rebuilds it by walking the records.
+//
+// A recording only replays in a build with the same State: same
+// BOLT_REPLICATION, MAX_BOLTS and sizeof(State). The header says which.
+//
+// Include after State (common_4.hpp does).
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RECORDING_MAGIC "PLASMREC"
+#define RECORDING_VERSION (1)
+
+struct RecordingHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t stateBytes;   // sizeof(State) when it was recorded
+  uint32_t replication;  // BOLT_REPLICATION
+  uint32_t maxBolts;     // MAX_BOLTS
+
+  void fill(){
+    memcpy(magic, RECORDING_MAGIC, 8);
+    version = RECORDING_VERSION;
+    stateBytes = sizeof(State);
+    replication = BOLT_REPLICATION;
+    maxBolts = MAX_BOLTS;
+  }
+
+  // whether this build can read what this header starts
+  bool matches() const {
+    RecordingHeader mine;
+    mine.fill();
+    return memcmp(this, &mine, sizeof mine) == 0;
+  }
+};
+
+struct RecordedFrame {
+  uint32_t bytes;  // encoded State that follows
+  int32_t frame;
+  double time;     // State::time
+};
+
+struct RecordingIndexEntry {
+  int32_t frame;
+  uint32_t bytes;   // of the whole record, RecordedFrame included
+  double time;
+  uint64_t offset;  // of the record in the recording
+};
+
+// the used part of state into out, which must hold sizeof(State) bytes:
+// the fields before the bolt updates, the live updates, the geometries
+// (and in REPLICATE_GEOMETRY their centre lines) and the fields after the
+// payload. returns the bytes written
+inline uint32_t encodeState(const State& state, char* out){
+  char* p = out;
+  const char* s = (const char*)&state;
+  memcpy(p, s, offsetof(State, update));
+  p += offsetof(State, update);
+  memcpy(p, state.update, state.numberOfBolts * sizeof(BoltUpdate));
+  p += state.numberOfBolts * sizeof(BoltUpdate);
+  memcpy(p, &state.numberOfGeometries, sizeof(int));
+  p += sizeof(int);
+#if BOLT_REPLICATION == REPLICATE_SEED
+  memcpy(p, state.seedBolt, state.numberOfGeometries * sizeof(SeedBolt));
+  p += state.numberOfGeometries * sizeof(SeedBolt);
+#else
+  memcpy(p, state.flatBolt, state.numberOfGeometries * sizeof(FlatBolt));
+  p += state.numberOfGeometries * sizeof(FlatBolt);
+  memcpy(p, &state.numberOfPoints, sizeof(int));
+  p += sizeof(int);
+  memcpy(p, state.payload, state.numberOfPoints * sizeof(PackedPoint));
+  p += state.numberOfPoints * sizeof(PackedPoint);
+#endif
+  memcpy(p, s + offsetof(State, nucleusPose), sizeof(State) - offsetof(State, nucleusPose));
+  p += sizeof(State) - offsetof(State, nucleusPose);
+  return p - out;
+}
+
+// the other way, false if the bytes don't make a State
+inline bool decodeState(const char* in, uint32_t bytes, State& state){
+  const char* p = in;
+  const char* end = in + bytes;
+  char* s = (char*)&state;
+#define TAKE(to, n) do{ size_t count = (n); if((size_t)(end - p) < count) return false; \
+                        memcpy((void*)(to), p, count); p += count; }while(0)
+  TAKE(s, offsetof(State, update));
+  if(state.numberOfBolts < 0 || state.numberOfBolts > MAX_BOLTS) return false;
+  TAKE(state.update, state.numberOfBolts * sizeof(BoltUpdate));
+  TAKE(&state.numberOfGeometries, sizeof(int));
+  if(state.numberOfGeometries < 0 || state.numberOfGeometries > MAX_GEOMETRIES) return false;
+#if BOLT_REPLICATION == REPLICATE_SEED
+  TAKE(state.seedBolt, state.numberOfGeometries * sizeof(SeedBolt));
+#else
+  TAKE(state.flatBolt, state.numberOfGeometries * sizeof(FlatBolt));
+  TAKE(&state.numberOfPoints, sizeof(int));
+  if(state.numberOfPoints < 0 || state.numberOfPoints > PAYLOAD_POINTS) return false;
+  TAKE(state.payload, state.numberOfPoints * sizeof(PackedPoint));
+#endif
+  TAKE(s + offsetof(State, nucleusPose), sizeof(State) - offsetof(State, nucleusPose));
+#undef TAKE
+  return p == end;
+}
+
+class StateRecorder {
+  public:
+  StateRecorder() : file(0), index(0), offset(0), frames(0) {}
+  ~StateRecorder(){ close(); }
+
+  bool open(const std::string& path){
+    close();
+    file = fopen(path.c_str(), "wb");
+    index = fopen((path + ".index").c_str(), "wb");
+    if(!file || !index){
+      close();
+      return false;
+    }
+    RecordingHeader header;
+    header.fill();
+    fwrite(&header, sizeof header, 1, file);
+    fwrite(&header, sizeof header, 1, index);
+    offset = sizeof header;
+    frames = 0;
+    return true;
+  }
+
+  bool recording() const { return file != 0; }
+
+  int recorded() const { return frames; }
+
+  void record(const State& state){
+    if(!file) return;
+    PROFILE("record");
+    RecordedFrame frame;
+    frame.bytes = encodeState(state, encoded);
+    frame.frame = state.frame;
+    frame.time = state.time;
+    RecordingIndexEntry entry;
+    entry.frame = state.frame;
+    entry.bytes = sizeof frame + frame.bytes;
+    entry.time = state.time;
+    entry.offset = offset;
+    fwrite(&frame, sizeof frame, 1, file);
+    fwrite(encoded, frame.bytes, 1, file);
+    fwrite(&entry, sizeof entry, 1, index);
+    offset += entry.bytes;
+    frames++;
+  }
+
+  void close(){
+    if(file) fclose(file);
+    if(index) fclose(index);
+    file = index = 0;
+  }
+
+  private:
+  FILE* file;
+  FILE* index;
+  uint64_t offset;  // where the next record goes
+  int frames;
+  char encoded[sizeof(State)];
+};
+
+// how StateReplay::get() moves through the frames
+enum ReplayMode {
+  REPLAY_REAL_TIME,  // as fast as they were recorded, by State::time
+  REPLAY_FAST,       // one frame per get()
+  REPLAY_STEP        // one frame per step()
+};
+
+class StateReplay {
+  public:
+  ReplayMode mode;
+  bool loop;  // start over after the last frame
+
+  StateReplay() : mode(REPLAY_REAL_TIME), loop(true), data(0), dataBytes(0),
+                  mapped(0), mappedBytes(0), entries(0), count(0), current(-1), steps(0),
+                  started(false), startTime(0) {}
+  ~StateReplay(){ close(); }
+
+  // map a recording and its index, false with a message on stderr if it
+  // can't be read by this build
+  bool open(const std::string& path){
+    close();
+    data = (const char*)map(path, dataBytes);
+    if(!data){
+      fprintf(stderr, "can't read %s\n", path.c_str());
+      return false;
+    }
+    if(dataBytes < sizeof(RecordingHeader) || !((const RecordingHeader*)data)->matches()){
+      fprintf(stderr, "%s was not recorded by a build with this State\n", path.c_str());
+      close();
+      return false;
+    }
+    size_t indexBytes = 0;
+    mapped = map(path + ".index", indexBytes);
+    mappedBytes = indexBytes;
+    if(mapped && indexBytes >= sizeof(RecordingHeader) &&
+       ((const RecordingHeader*)mapped)->matches()){
+      entries = (const RecordingIndexEntry*)((const char*)mapped + sizeof(RecordingHeader));
+      count = (indexBytes - sizeof(RecordingHeader)) / sizeof(RecordingIndexEntry);
+    }
+    // entries past the end of the recording were never written out whole
+    while(count > 0 && entries[count - 1].offset + entries[count - 1].bytes > dataBytes) count--;
+    if(count == 0 || entries[count - 1].offset + entries[count - 1].bytes < dataBytes){
+      rebuildIndex();
+    }
+    current = -1;
+    return true;
+  }
+
+  void close(){
+    if(data) munmap((void*)data, dataBytes);
+    if(mapped) munmap(mapped, mappedBytes);
+    data = 0;
+    mapped = 0;
+    entries = 0;
+    count = 0;
+    rebuilt.clear();
+  }
+
+  bool opened() const { return data != 0; }
+
+  int frames() const { return count; }
+
+  // the i-th recorded frame's State::frame and State::time
+  int frameNumber(int i) const { return entries[i].frame; }
+  double time(int i) const { return entries[i].time; }
+
+  // the frame shown last, -1 before the first get()
+  int position() const { return current; }
+
+  // the first frame whose State::frame is at least frame
+  int find(int frame) const {
+    int lo = 0, hi = count;
+    while(lo < hi){
+      int mid = (lo + hi) / 2;
+      if(entries[mid].frame < frame) lo = mid + 1;
+      else hi = mid;
+    }
+    return lo;
+  }
+
+  // the first frame at or after simulator time t
+  int findTime(double t) const {
+    int lo = 0, hi = count;
+    while(lo < hi){
+      int mid = (lo + hi) / 2;
+      if(entries[mid].time < t) lo = mid + 1;
+      else hi = mid;
+    }
+    return lo;
+  }
+
+  // the next get() starts from the i-th frame
+  void seek(int i){
+    current = std::max(-1, std::min(i, count) - 1);
+    started = false;
+  }
+
+  // the i-th frame into state
+  bool read(int i, State& state) const {
+    if(i < 0 || i >= count) return false;
+    const RecordingIndexEntry& entry = entries[i];
+    RecordedFrame frame;  // records are packed, so it may be unaligned
+    memcpy(&frame, data + entry.offset, sizeof frame);
+    if(sizeof frame + frame.bytes != entry.bytes) return false;
+    return decodeState(data + entry.offset + sizeof frame, frame.bytes, state);
+  }
+
+  // REPLAY_STEP: let the next get() move one frame on
+  void step(){ steps++; }
+
+  // like cuttlebone::Taker::get(), the newest frame that is due into state
+  // and how many frames went by since the last call, 0 if none did
+  int get(State& state){
+    if(count == 0) return 0;
+    int target = current;
+    if(mode == REPLAY_FAST){
+      target = current + 1;
+    }else if(mode == REPLAY_STEP){
+      target = current + steps;
+      steps = 0;
+    }else{
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if(!started){
+        started = true;
+        startedAt = now;
+        startTime = current + 1 < count ? entries[current + 1].time : entries[0].time;
+      }
+      double t = startTime + std::chrono::duration<double>(now - startedAt).count();
+      int due = findTime(t + 1e-9);  // the first frame still to come
+      target = std::max(current, due - 1);
+      // the last frame has had its time on screen
+      if(due == count && t > entries[count - 1].time + 1 / ANIMATION_RATE) target = count;
+    }
+    if(target >= count){
+      if(!loop){
+        target = count - 1;
+      }else if(mode == REPLAY_REAL_TIME){
+        seek(0);
+        return get(state);
+      }else{
+        current = -1;
+        target = 0;
+      }
+    }
+    if(target <= current) return 0;
+    int advanced = target - current;
+    current = target;
+    return read(current, state) ? advanced : 0;
+  }
+
+  private:
+  const char* data;
+  size_t dataBytes;
+  void* mapped;  // the index file
+  size_t mappedBytes;
+  const RecordingIndexEntry* entries;  // in mapped, or rebuilt
+  int count;
+  std::vector<RecordingIndexEntry> rebuilt;
+  int current;
+  int steps;
+  bool started;
+  std::chrono::steady_clock::time_point startedAt;
+  double startTime;  // State::time of the frame playing started from
+
+  static void* map(const std::string& path, size_t& bytes){
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) return 0;
+    struct stat info;
+    void* address = 0;
+    if(fstat(fd, &info) == 0 && info.st_size > 0){
+      bytes = info.st_size;
+      address = mmap(0, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(address == MAP_FAILED) address = 0;
+    }
+    ::close(fd);
+    return address;
+  }
+
+  // walk the records for the index the sidecar should have had
+  void rebuildIndex(){
+    rebuilt.clear();
+    uint64_t offset = sizeof(RecordingHeader);
+    while(offset + sizeof(RecordedFrame) <= dataBytes){
+      RecordedFrame frame;
+      memcpy(&frame, data + offset, sizeof frame);
+      uint64_t bytes = sizeof frame + frame.bytes;
+      if(offset + bytes > dataBytes) break;
+      RecordingIndexEntry entry;
+      entry.frame = frame.frame;
+      entry.bytes = bytes;
+      entry.time = frame.time;
+      entry.offset = offset;
+      rebuilt.push_back(entry);
+      offset += bytes;
+    }
+    entries = rebuilt.empty() ? 0 : &rebuilt[0];
+    count = rebuilt.size();
+  }
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __BOLT_RIBBON__
+#define __BOLT_RIBBON__
+
+// Ribbon expansion kernels
+//
+// Turning a bolt's centre line into a ribbon means moving every point by
+// +offset and -offset along the run's normal. The points are kept as
+// structure-of-arrays, so this is one kernel call per coordinate:
+//    plus[i] = in[i] + offset, minus[i] = in[i] - offset
+// There is a scalar version, and SSE and AVX2 versions on x86 that are
+// picked at run time from what the CPU supports.
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BOLT_RIBBON_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*RibbonKernel)(const float* in, int count, float offset,
+                             float* plus, float* minus);
+
+inline void ribbonScalar(const float* in, int count, float offset, float* plus,
+                         float* minus) {
+  for (int i = 0; i < count; i++) {
+    plus[i] = in[i] + offset;
+    minus[i] = in[i] - offset;
+  }
+}
+
+#ifdef BOLT_RIBBON_X86
+__attribute__((target("sse2")))
+inline void ribbonSSE(const float* in, int count, float offset, float* plus,
+                      float* minus) {
+  __m128 o = _mm_set1_ps(offset);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 p = _mm_loadu_ps(in + i);
+    _mm_storeu_ps(plus + i, _mm_add_ps(p, o));
+    _mm_storeu_ps(minus + i, _mm_sub_ps(p, o));
+  }
+  ribbonScalar(in + i, count - i, offset, plus + i, minus + i);
+}
+
+__attribute__((target("avx2")))
+inline void ribbonAVX2(const float* in, int count, float offset, float* plus,
+                       float* minus) {
+  __m256 o = _mm256_set1_ps(offset);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 p = _mm256_loadu_ps(in + i);
+    _mm256_storeu_ps(plus + i, _mm256_add_ps(p, o));
+    _mm256_storeu_ps(minus + i, _mm256_sub_ps(p, o));
+  }
+  ribbonScalar(in + i, count - i, offset, plus + i, minus + i);
+}
+#endif
+
+// the fastest kernel this CPU runs
+inline RibbonKernel bestRibbonKernel() {
+#ifdef BOLT_RIBBON_X86
+  if (__builtin_cpu_supports("avx2")) return ribbonAVX2;
+  if (__builtin_cpu_supports("sse2")) return ribbonSSE;
+#endif
+  return ribbonScalar;
+}
+
+#endif
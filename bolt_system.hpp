@@ -0,0 +1,160 @@
+#ifndef __BOLT_SYSTEM__
+#define __BOLT_SYSTEM__
+
+// Per-frame state of the live bolts
+//
+// Every frame each live bolt needs its countdown, fade and bulge brought up
+// to the simulator time. Those few numbers live here, one array per field
+// with the i-th bolt at index i, so update() is one straight loop over
+// contiguous floats that the compiler vectorizes and that never touches a
+// Bolt. A Bolt keeps what only changes when it is struck, its mesh, colour
+// and seed. Its colours are never rewritten: BoltBatch hands the fade
+// exponent to the bolt shaders with the vertices.
+//
+// Bolts stay in the order they were added, oldest first from head. Adding
+// to a full system puts the new bolt in the oldest one's place and moves
+// head on, so a strike at the cap costs the same as any other.
+// retireExpired() keeps the order and brings the oldest back to index 0.
+//
+// Include after Bolt (common_4.hpp does).
+
+#include <algorithm>
+
+class BoltSystem {
+  public:
+  int count;
+  int head;  // index of the oldest bolt, the others follow it round to head - 1
+  Bolt* bolt[MAX_BOLTS];  // where the i-th bolt's geometry is
+
+  // set by add()
+  double spawnTime[MAX_BOLTS];  // simulator time, a float would round it hours in
+  float nucleusX[MAX_BOLTS], nucleusY[MAX_BOLTS], nucleusZ[MAX_BOLTS];
+  float reachX[MAX_BOLTS], reachY[MAX_BOLTS], reachZ[MAX_BOLTS];  // ending - nucleus
+
+  // set by update()
+  float timer[MAX_BOLTS];   // seconds left to live
+  float fadeExponent[MAX_BOLTS];
+  float bulgeX[MAX_BOLTS], bulgeY[MAX_BOLTS], bulgeZ[MAX_BOLTS];
+  float bulgeScale[MAX_BOLTS];
+
+  BoltSystem() : count(0), head(0) {}
+
+  int size() const { return count; }
+
+  void clear(){ count = head = 0; }
+
+  Bolt* oldest() const { return bolt[head]; }
+
+  // the bolt goes after the others, returns its index. when the system is
+  // full it takes the oldest bolt's place, b should be that bolt
+  int add(Bolt* b){
+    int i;
+    if(count == MAX_BOLTS){
+      i = head;
+      head = (head + 1) % MAX_BOLTS;
+    }else{
+      i = count++;
+    }
+    bolt[i] = b;
+    spawnTime[i] = b->spawnTime;
+    Vec3f reach = b->ending - b->nucleus;
+    nucleusX[i] = b->nucleus.x;
+    nucleusY[i] = b->nucleus.y;
+    nucleusZ[i] = b->nucleus.z;
+    reachX[i] = reach.x;
+    reachY[i] = reach.y;
+    reachZ[i] = reach.z;
+    timer[i] = BOLT_LIFETIME;
+    fadeExponent[i] = 0;
+    bulgeX[i] = b->nucleus.x + 0.6f * reach.x;
+    bulgeY[i] = b->nucleus.y + 0.6f * reach.y;
+    bulgeZ[i] = b->nucleus.z + 0.6f * reach.z;
+    bulgeScale[i] = 0.035f;
+    return i;
+  }
+
+  // bring every bolt to the simulator time now. bolts hold still for 0.3s,
+  // then lose one fade step per frame at ANIMATION_RATE. the bulge starts
+  // 60% of the way out to the bolt's end, pushes outward for the first
+  // 0.35s, then sinks back into the nucleus while it swells, up to twice
+  // its size
+  void update(double now){
+    const float rate = ANIMATION_RATE;
+    const float push = 0.35f * rate;
+    for(int i = 0; i < count; i++){
+      float age = now - spawnTime[i];  // small, so a float from here on
+      float frames = positive(age * rate);
+      float pushing = atMost(frames, push);
+      float sinking = frames - pushing;
+      float out = 0.6f + 0.015f * pushing - 0.007f * sinking;
+      timer[i] = BOLT_LIFETIME - age;
+      fadeExponent[i] = positive((age - 0.3f) * rate);
+      bulgeX[i] = nucleusX[i] + reachX[i] * out;
+      bulgeY[i] = nucleusY[i] + reachY[i] * out;
+      bulgeZ[i] = nucleusZ[i] + reachZ[i] * out;
+      bulgeScale[i] = atMost(0.035f + 0.0002f * sinking, 0.07f);
+    }
+  }
+
+  Vec3f bulgePosition(int i) const { return Vec3f(bulgeX[i], bulgeY[i], bulgeZ[i]); }
+
+  // drop the bolts that have faded out and write them to expired, the others
+  // keep their order. returns how many were dropped
+  int retireExpired(Bolt** expired){
+    int kept = 0;
+    int dropped = 0;
+    int oldest = 0;  // where the bolt at head ends up
+    for(int i = 0; i < count; i++){
+      if(i == head) oldest = kept;
+      if(timer[i] < 0.002f){
+        expired[dropped++] = bolt[i];
+      }else{
+        if(kept != i) move(i, kept);
+        kept++;
+      }
+    }
+    if(dropped == 0) return 0;
+    count = kept;
+    // add() only appends with the oldest at 0
+    if(oldest > 0 && oldest < count) rotate(oldest);
+    head = 0;
+    return dropped;
+  }
+
+  private:
+  // max(x, 0) and min(x, c) without comparisons. a float comparison may
+  // trap, so GCC won't turn one into a vector select unless it is built with
+  // -fno-trapping-math, and update() would stay scalar
+  static float positive(float x){ return 0.5f * (x + std::fabs(x)); }
+  static float atMost(float x, float c){ return c - positive(c - x); }
+
+  // bring index first down to 0, keeping the order round
+  void rotate(int first){
+    std::rotate(bolt, bolt + first, bolt + count);
+    std::rotate(spawnTime, spawnTime + first, spawnTime + count);
+    float* field[] = { nucleusX, nucleusY, nucleusZ, reachX, reachY, reachZ,
+                       timer, fadeExponent, bulgeX, bulgeY, bulgeZ, bulgeScale };
+    for(int f = 0; f < (int)(sizeof field / sizeof field[0]); f++){
+      std::rotate(field[f], field[f] + first, field[f] + count);
+    }
+  }
+
+  void move(int from, int to){
+    bolt[to] = bolt[from];
+    spawnTime[to] = spawnTime[from];
+    nucleusX[to] = nucleusX[from];
+    nucleusY[to] = nucleusY[from];
+    nucleusZ[to] = nucleusZ[from];
+    reachX[to] = reachX[from];
+    reachY[to] = reachY[from];
+    reachZ[to] = reachZ[from];
+    timer[to] = timer[from];
+    fadeExponent[to] = fadeExponent[from];
+    bulgeX[to] = bulgeX[from];
+    bulgeY[to] = bulgeY[from];
+    bulgeZ[to] = bulgeZ[from];
+    bulgeScale[to] = bulgeScale[from];
+  }
+};
+
+#endif
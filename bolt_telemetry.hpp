@@ -0,0 +1,259 @@
+#ifndef __BOLT_TELEMETRY__
+#define __BOLT_TELEMETRY__
+
+// Network telemetry
+//
+// What the State broadcast actually costs and how it arrives, measured
+// rather than worked out from sizeof(State). The simulator stamps every
+// State with its frame number and the wall clock time it was handed to
+// cuttlebone; SendTelemetry counts what went out and how long handing it
+// over took. A renderer's ReceiveTelemetry checks each State it takes
+// against the last one: frames it never saw, States that arrived but were
+// replaced by a newer one before it could take them, repeats, how late they
+// are and how long taker.get() took.
+//
+// Both add up a one second window, write it as a row of a CSV log and
+// print it every TELEMETRY_PRINT_EVERY windows. Latency compares two
+// machines' wall clocks, so it is only as good as their clock sync (NTP
+// keeps the AlloSphere machines within a millisecond or so).
+//
+// Include after State (common_4.hpp does).
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+#define STATE_PACKET_SIZE (1400)      // cuttlebone's default packet size
+#define TELEMETRY_PRINT_EVERY (10)    // windows between console reports
+
+// microseconds since the epoch, comparable between synced machines
+inline int64_t wallMicros(){
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// the part of a State that carries anything this frame. cuttlebone sends
+// all sizeof(State) bytes whatever is in them
+inline int usedBytes(const State& state){
+  int bytes = offsetof(State, update) + state.numberOfBolts * sizeof(BoltUpdate);
+#if BOLT_REPLICATION == REPLICATE_SEED
+  bytes += state.numberOfGeometries * sizeof(SeedBolt);
+#else
+  bytes += state.numberOfGeometries * sizeof(FlatBolt) +
+           state.numberOfPoints * sizeof(PackedPoint);
+#endif
+  return bytes;
+}
+
+// a CSV file that gets one row per window, and the clock windows close on
+class TelemetryLog {
+  public:
+  TelemetryLog() : file(0), windows(0), start(std::chrono::steady_clock::now()), opened(start) {}
+  ~TelemetryLog(){ if(file) fclose(file); }
+
+  // $BOLT_TELEMETRY if it is set, otherwise path. an empty path logs
+  // nothing, the console still gets its reports
+  void open(const char* path, const char* header){
+    const char* chosen = getenv("BOLT_TELEMETRY");
+    if(!chosen) chosen = path;
+    if(!chosen[0]) return;
+    file = fopen(chosen, "w");
+    if(!file){
+      fprintf(stderr, "can't write telemetry to %s\n", chosen);
+      return;
+    }
+    fprintf(file, "seconds,%s\n", header);
+    fflush(file);
+  }
+
+  double seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // true once a second, when the caller should write its window
+  bool windowClosed(){
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(now - opened < std::chrono::seconds(1)) return false;
+    opened = now;
+    windows++;
+    return true;
+  }
+
+  // whether this window also goes to the console
+  bool printing() const { return windows % TELEMETRY_PRINT_EVERY == 0; }
+
+  void row(const char* values){
+    if(!file) return;
+    fprintf(file, "%.3f,%s\n", seconds(), values);
+    fflush(file);
+  }
+
+  private:
+  FILE* file;
+  long windows;
+  std::chrono::steady_clock::time_point start, opened;
+};
+
+// the simulator's side: call sending() right before every maker.set() and
+// sent() right after
+class SendTelemetry {
+  public:
+  SendTelemetry() : last(0), began(0) { clear(); }
+
+  void open(const char* path){
+    log.open(path, "frames,state_bytes,packets_per_frame,used_bytes,megabytes_per_second,"
+                   "set_ms_mean,set_ms_max,period_ms_max");
+    printf("State is %d bytes, %d packets of %d per frame\n", (int)sizeof(State),
+           packetsPerState(), STATE_PACKET_SIZE);
+  }
+
+  // stamps the state
+  void sending(State& state){
+    state.sent = wallMicros();
+    began = log.seconds();
+  }
+
+  // cuttlebone has state
+  void sent(const State& state){
+    double now = log.seconds();
+    double setSeconds = now - began;
+    if(last > 0 && now - last > periodMax) periodMax = now - last;
+    last = now;
+    frames++;
+    used += usedBytes(state);
+    setTotal += setSeconds;
+    if(setSeconds > setMax) setMax = setSeconds;
+
+    if(!log.windowClosed()) return;
+    // cuttlebone sends the whole State every frame in whole packets
+    double megabytes = frames * (double)sizeof(State) / 1e6;
+    char values[256];
+    snprintf(values, sizeof values, "%ld,%d,%d,%.0f,%.3f,%.3f,%.3f,%.3f", frames,
+             (int)sizeof(State), packetsPerState(), used / frames, megabytes,
+             setTotal / frames * 1e3, setMax * 1e3, periodMax * 1e3);
+    log.row(values);
+    if(log.printing()){
+      printf("sent %ld frames/s, %.2f MB/s (%.1f%% of 1GbE), %.0f of %d bytes used, "
+             "maker.set mean %.3f ms max %.3f ms, longest gap %.1f ms\n",
+             frames, megabytes, 100 * megabytes / 118, used / frames, (int)sizeof(State),
+             setTotal / frames * 1e3, setMax * 1e3, periodMax * 1e3);
+    }
+    clear();
+  }
+
+  private:
+  TelemetryLog log;
+  double last;   // when the last state went out
+  double began;  // when this one was handed over
+  long frames;
+  double used, setTotal, setMax, periodMax;
+
+  static int packetsPerState(){ return (sizeof(State) + STATE_PACKET_SIZE - 1) / STATE_PACKET_SIZE; }
+
+  void clear(){
+    frames = 0;
+    used = setTotal = setMax = periodMax = 0;
+  }
+};
+
+// a renderer's side: call taking() right before every taker.get() and
+// received() right after, with what it returned, the number of States it
+// popped. SharedStateReader::take() counts the frames the triple buffer
+// overwrote the same way, so they come out superseded rather than missed
+class ReceiveTelemetry {
+  public:
+  ReceiveTelemetry() : lastFrame(-1), began(0) { clear(); }
+
+  void open(const char* path){
+    log.open(path, "states,empty_gets,missed_frames,superseded,duplicates,"
+                   "latency_ms_mean,latency_ms_max,get_ms_mean,get_ms_max,"
+                   "face_passes,bolts_drawn_per_face,bolts_culled_per_face,"
+                   "bulges_drawn_per_face,bulges_culled_per_face");
+  }
+
+  // what the faces drew since the last call, then clears it
+  void drew(FaceCuller& culler){
+    passes += culler.passes;
+    boltsDrawn += culler.boltsDrawn;
+    boltsCulled += culler.boltsCulled;
+    bulgesDrawn += culler.bulgesDrawn;
+    bulgesCulled += culler.bulgesCulled;
+    culler.clearCounts();
+  }
+
+  void taking(){ began = log.seconds(); }
+
+  // taker.get() popped that many States, the last one into state
+  void received(const State& state, int popped){
+    double getSeconds = log.seconds() - began;
+    gets++;
+    getTotal += getSeconds;
+    if(getSeconds > getMax) getMax = getSeconds;
+    if(popped < 1){
+      empty++;
+    }else{
+      states++;
+      // the ones popped before the last never got drawn
+      superseded += popped - 1;
+      if(state.frame == lastFrame){
+        duplicates++;
+      }else if(lastFrame >= 0 && state.frame > lastFrame){
+        // frames that left the simulator but neither came through nor were
+        // replaced by one that did
+        int gap = state.frame - lastFrame - popped;
+        if(gap > 0) missed += gap;
+      }
+      lastFrame = state.frame;
+      double latency = (wallMicros() - state.sent) / 1e3;
+      latencyTotal += latency;
+      if(latency > latencyMax) latencyMax = latency;
+    }
+
+    if(!log.windowClosed()) return;
+    double taken = states > 0 ? states : 1;
+    double faces = passes > 0 ? passes : 1;
+    char values[320];
+    snprintf(values, sizeof values, "%ld,%ld,%ld,%ld,%ld,%.3f,%.3f,%.3f,%.3f,%ld,%.1f,%.1f,%.1f,%.1f",
+             states, empty, missed, superseded, duplicates, latencyTotal / taken, latencyMax,
+             getTotal / gets * 1e3, getMax * 1e3, passes, boltsDrawn / faces, boltsCulled / faces,
+             bulgesDrawn / faces, bulgesCulled / faces);
+    log.row(values);
+    if(log.printing()){
+      printf("took %ld states/s (%ld empty gets), missed %ld frames, %ld superseded, "
+             "%ld repeated, latency mean %.2f ms max %.2f ms, taker.get mean %.3f ms max %.3f ms\n",
+             states, empty, missed, superseded, duplicates, latencyTotal / taken, latencyMax,
+             getTotal / gets * 1e3, getMax * 1e3);
+      if(passes > 0){
+        printf("each face drew %.1f bolts (%.1f culled) and %.1f bulges (%.1f culled)\n",
+               boltsDrawn / faces, boltsCulled / faces, bulgesDrawn / faces, bulgesCulled / faces);
+      }
+    }
+    clear();
+  }
+
+  private:
+  TelemetryLog log;
+  int lastFrame;
+  double began;  // when taker.get() was called
+  long gets, states, empty, missed, superseded, duplicates;
+  double latencyTotal, latencyMax, getTotal, getMax;
+  long passes, boltsDrawn, boltsCulled, bulgesDrawn, bulgesCulled;
+
+  void clear(){
+    gets = states = empty = missed = superseded = duplicates = 0;
+    latencyTotal = latencyMax = getTotal = getMax = 0;
+    passes = boltsDrawn = boltsCulled = bulgesDrawn = bulgesCulled = 0;
+  }
+};
+
+// this machine's name, for telling the renderers' logs apart
+inline std::string hostName(){
+  char name[256] = "";
+  gethostname(name, sizeof name - 1);
+  return name;
+}
+
+#endif
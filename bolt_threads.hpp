@@ -0,0 +1,131 @@
+#ifndef __BOLT_THREADS__
+#define __BOLT_THREADS__
+
+// Work-stealing thread pool for bolt generation
+//
+// run() hands out tasks 0 .. count - 1 and returns once all of them are
+// done. Every thread, the caller included, starts on its own contiguous
+// share of the tasks, takes them from the back, and once its share is gone
+// steals from the front of the others'. A share is just a range of task
+// numbers, so handing out work never allocates.
+//
+// One run() at a time: a pool belongs to one generator on one thread.
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#define MAX_BOLT_THREADS (64)
+
+class BoltThreads {
+  public:
+  typedef void (*Task)(void* context, int task);
+
+  explicit BoltThreads(int count = std::thread::hardware_concurrency())
+    : round(0), quitting(false), finished(0), task(0), context(0) {
+    threads = std::max(1, std::min(count, MAX_BOLT_THREADS));
+    for(int i = 1; i < threads; i++){
+      helper.push_back(std::thread(&BoltThreads::help, this, i));
+    }
+  }
+
+  ~BoltThreads(){
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      quitting = true;
+    }
+    wake.notify_all();
+    for(size_t i = 0; i < helper.size(); i++) helper[i].join();
+  }
+
+  int size() const { return threads; }
+
+  void run(int count, Task t, void* c){
+    if(count <= 0) return;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      task = t;
+      context = c;
+      for(int i = 0; i < threads; i++){
+        std::lock_guard<std::mutex> share(queue[i].lock);
+        queue[i].begin = (long)count * i / threads;
+        queue[i].end = (long)count * (i + 1) / threads;
+      }
+      finished = 0;
+      round++;
+    }
+    wake.notify_all();
+    work(0);
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this]{ return finished == threads - 1; });
+  }
+
+  private:
+  struct Queue {
+    std::mutex lock;
+    int begin;
+    int end;
+    Queue() : begin(0), end(0) {}
+  };
+
+  int threads;
+  Queue queue[MAX_BOLT_THREADS];
+  std::vector<std::thread> helper;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  unsigned round;
+  bool quitting;
+  int finished;  // helpers through with this round
+  Task task;
+  void* context;
+
+  void help(int self){
+    unsigned seen = 0;
+    while(true){
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [&]{ return quitting || round != seen; });
+        if(quitting) return;
+        seen = round;
+      }
+      work(self);
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        finished++;
+      }
+      done.notify_one();
+    }
+  }
+
+  void work(int self){
+    int i;
+    while(next(self, i)){
+      task(context, i);
+    }
+  }
+
+  // own tasks from the back, then other threads' from the front
+  bool next(int self, int& i){
+    {
+      Queue& mine = queue[self];
+      std::lock_guard<std::mutex> guard(mine.lock);
+      if(mine.begin < mine.end){
+        i = --mine.end;
+        return true;
+      }
+    }
+    for(int k = 1; k < threads; k++){
+      Queue& other = queue[(self + k) % threads];
+      std::lock_guard<std::mutex> guard(other.lock);
+      if(other.begin < other.end){
+        i = other.begin++;
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+#endif
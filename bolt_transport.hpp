@@ -0,0 +1,167 @@
+#ifndef __BOLT_TRANSPORT__
+#define __BOLT_TRANSPORT__
+
+// Shared memory State transport
+//
+// When the simulator and a renderer share a machine (rehearsing on a
+// laptop, a one-node install) the State doesn't need cuttlebone's UDP
+// broadcast and its copies. SharedStateWriter and SharedStateReader share a
+// triple buffer of States in POSIX shared memory: the simulator packs the
+// next frame straight into the slot it owns and publishes it, the renderer
+// picks up the newest published slot and reads it where it lies. Neither
+// copies a State or waits for the other; publishing and taking are one
+// atomic exchange each.
+//
+// Of the three slots the writer owns one (back), the reader owns one
+// (front) and the third holds the newest frame. publish() swaps back with
+// it and marks it fresh; take() swaps front with it if it is fresh. The
+// reader keeps its slot in the block too, so either side can restart
+// without the other.
+//
+// One reader per block. Pick the transport with --transport shm on both
+// the simulator and the renderer, udp is the default. Linking may need
+// -lrt on older glibc.
+//
+// Include after State (common_4.hpp does).
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHARED_STATE_NAME "/plasmaball_state"
+#define SHARED_STATE_MAGIC (0x504c534du)  // "PLSM"
+
+enum Transport {
+  TRANSPORT_UDP,     // cuttlebone Maker and Taker
+  TRANSPORT_SHARED   // SharedStateWriter and SharedStateReader
+};
+
+// "udp" or "shm", anything else is an error
+inline bool parseTransport(const char* name, Transport& transport){
+  if(!strcmp(name, "udp")) transport = TRANSPORT_UDP;
+  else if(!strcmp(name, "shm")) transport = TRANSPORT_SHARED;
+  else return false;
+  return true;
+}
+
+struct SharedStateBlock {
+  uint32_t magic;
+  uint32_t stateBytes;            // sizeof(State) of the writer
+  std::atomic<uint32_t> latest;   // slot of the newest frame, | FRESH until taken
+  std::atomic<uint32_t> front;    // slot the reader holds
+  State slot[3];
+
+  enum { FRESH = 4, SLOT = 3 };
+};
+
+// maps the block, creating it when create is set. 0 if it can't
+inline SharedStateBlock* mapSharedState(const char* name, bool create){
+  int fd = shm_open(name, create ? O_RDWR | O_CREAT : O_RDWR, 0600);
+  if(fd < 0) return 0;
+  if(create && ftruncate(fd, sizeof(SharedStateBlock)) != 0){
+    close(fd);
+    return 0;
+  }
+  struct stat info;
+  void* address = MAP_FAILED;
+  if(fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(SharedStateBlock)){
+    address = mmap(0, sizeof(SharedStateBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  return address == MAP_FAILED ? 0 : (SharedStateBlock*)address;
+}
+
+class SharedStateWriter {
+  public:
+  SharedStateWriter() : block(0), back(1) {}
+  ~SharedStateWriter(){ if(block) munmap(block, sizeof(SharedStateBlock)); }
+
+  bool create(const char* name = SHARED_STATE_NAME){
+    block = mapSharedState(name, true);
+    if(!block){
+      perror("shared memory State");
+      return false;
+    }
+    if(block->magic != SHARED_STATE_MAGIC || block->stateBytes != sizeof(State)){
+      block->latest.store(0);
+      block->front.store(2);
+      block->stateBytes = sizeof(State);
+      block->magic = SHARED_STATE_MAGIC;
+    }
+    // a block left by an earlier simulator: its last frame is stale, and
+    // this one takes whichever slot is free
+    uint32_t latest = block->latest.fetch_and(SharedStateBlock::SLOT) & SharedStateBlock::SLOT;
+    uint32_t front = block->front.load();
+    for(back = 0; back == latest || back == front; back++);
+    return true;
+  }
+
+  bool opened() const { return block != 0; }
+
+  // the slot to pack the next frame into
+  State& next(){ return block->slot[back]; }
+
+  // next() becomes the newest frame, next() is another slot afterwards
+  void publish(){
+    back = block->latest.exchange(back | SharedStateBlock::FRESH, std::memory_order_acq_rel) &
+           SharedStateBlock::SLOT;
+  }
+
+  private:
+  SharedStateBlock* block;
+  uint32_t back;
+};
+
+class SharedStateReader {
+  public:
+  SharedStateReader() : block(0), lastFrame(-1), lastRun(0) {}
+  ~SharedStateReader(){ if(block) munmap(block, sizeof(SharedStateBlock)); }
+
+  // false until the simulator has created the block
+  bool open(const char* name = SHARED_STATE_NAME){
+    block = mapSharedState(name, false);
+    if(block && (block->magic != SHARED_STATE_MAGIC || block->stateBytes != sizeof(State))){
+      fprintf(stderr, "shared memory State is from a different build\n");
+      munmap(block, sizeof(SharedStateBlock));
+      block = 0;
+    }
+    return block != 0;
+  }
+
+  bool opened() const { return block != 0; }
+
+  // like cuttlebone::Taker::get(), the number of frames published since
+  // the last call and 0 if none, but the frame stays where it is: state
+  // points at it until the next take(). Frames publish() overwrote before
+  // they were taken count too, as cuttlebone counts the ones it popped past
+  int take(const State*& state){
+    uint32_t front = block->front.load(std::memory_order_relaxed);
+    int fresh = 0;
+    if(block->latest.load(std::memory_order_acquire) & SharedStateBlock::FRESH){
+      front = block->latest.exchange(front, std::memory_order_acq_rel) & SharedStateBlock::SLOT;
+      block->front.store(front, std::memory_order_relaxed);
+      const State& taken = block->slot[front];
+      // the simulator numbers the frames it publishes, a new run starts over
+      fresh = 1;
+      if(lastFrame >= 0 && taken.run == lastRun && taken.frame > lastFrame){
+        fresh = taken.frame - lastFrame;
+      }
+      lastFrame = taken.frame;
+      lastRun = taken.run;
+    }
+    state = &block->slot[front];
+    return fresh;
+  }
+
+  private:
+  SharedStateBlock* block;
+  int lastFrame;  // of the last frame taken
+  unsigned lastRun;
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef __BOLT_WORKER__
+#define __BOLT_WORKER__
+
+// Background bolt generation
+//
+// The animation thread hands BoltSeeds to a worker thread and picks up the
+// finished meshes a frame or so later, so a strike never costs the frame it
+// happens in, however many branches it has. Requests and results share one
+// ring of jobs with three counters: the animation thread advances requested
+// and collected, the worker advances generated. Each counter has a single
+// writer, so the hand-off needs no locks.
+//
+// Renderers keep one too, for the breakdown bolts they lay out again from
+// their seeds: a request is tagged with the bolt's version, and the bolt
+// shows once its mesh is ready rather than stalling the frame.
+//
+// The worker uses its own BoltGenerator and seeds a BoltRandom from the
+// BoltSeed exactly like Bolt::strike, so the geometry is the same as if the
+// bolt had been struck in place and renderers still regenerate it exactly.
+//
+// Include after BoltSeed is defined (common_4.hpp does).
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#define BOLT_WORKER_JOBS (16)  // strikes that can be waiting or ready at once
+
+class BoltWorker {
+  public:
+  struct Job {
+    BoltSeed seed;
+    Mesh mesh;  // positions, tex coords and indices, colours are left to Bolt
+    unsigned tag;  // whatever the requester passed, handed back with the mesh
+  };
+
+  Job job[BOLT_WORKER_JOBS];
+  std::atomic<unsigned> requested;
+  std::atomic<unsigned> generated;
+  unsigned collected;  // animation thread only
+  std::atomic<bool> running;
+  std::thread thread;
+  BoltGenerator generator;
+  DbmGenerator dbm;
+  int ribbon;  // what emit() builds, set before start(). renderers want RIBBON_FACING
+
+  BoltWorker() : requested(0), generated(0), collected(0), running(false), ribbon(RIBBON_FLAT) {}
+  ~BoltWorker(){ stop(); }
+
+  void start(){
+    if(running) return;
+    running = true;
+    thread = std::thread(&BoltWorker::run, this);
+  }
+
+  void stop(){
+    running = false;
+    if(thread.joinable()) thread.join();
+  }
+
+  bool started() const { return running; }
+
+  // animation thread: queue a strike, false if every job is taken
+  bool request(const BoltSeed& s, unsigned tag = 0){
+    unsigned r = requested.load(std::memory_order_relaxed);
+    if(r - collected == BOLT_WORKER_JOBS) return false;
+    job[r % BOLT_WORKER_JOBS].seed = s;
+    job[r % BOLT_WORKER_JOBS].tag = tag;
+    requested.store(r + 1, std::memory_order_release);
+    return true;
+  }
+
+  // animation thread: whether a strike of seed with tag is waiting or ready.
+  // only the animation thread writes seed and tag, so they can be read here
+  bool queued(unsigned seed, unsigned tag) const {
+    unsigned r = requested.load(std::memory_order_relaxed);
+    for(unsigned j = collected; j != r; j++){
+      const Job& q = job[j % BOLT_WORKER_JOBS];
+      if(q.seed.seed == seed && q.tag == tag) return true;
+    }
+    return false;
+  }
+
+  // animation thread: the oldest finished strike, 0 if none is ready yet.
+  // it stays valid until release()
+  const Job* ready() const {
+    if(collected == generated.load(std::memory_order_acquire)) return 0;
+    return &job[collected % BOLT_WORKER_JOBS];
+  }
+
+  void release(){ collected++; }
+
+  // animation thread: whether a strike it asked for isn't generated yet
+  bool busy() const {
+    return generated.load(std::memory_order_acquire) != requested.load(std::memory_order_relaxed);
+  }
+
+  private:
+  void run(){
+    PROFILE_THREAD("bolt worker");
+    while(running){
+      unsigned g = generated.load(std::memory_order_relaxed);
+      if(g == requested.load(std::memory_order_acquire)){
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        continue;
+      }
+      PROFILE("generate");
+      Job& j = job[g % BOLT_WORKER_JOBS];
+      const BoltSeed& s = j.seed;
+      BoltRandom rng(s.seed);
+      j.mesh.reset();
+      layOutBolt(generator, dbm, rng, s);
+      generator.emit(j.mesh, Color(1), ribbon);
+      generated.store(g + 1, std::memory_order_release);
+    }
+  }
+};
+
+#endif
@@ -34,32 +34,216 @@
 //
 //
 
+// BOLT_HEADLESS builds the bolt code without allocore (bolt_benchmark.cpp)
+#ifdef BOLT_HEADLESS
+#include "bolt_headless.hpp"
+#else
 #include "allocore/io/al_App.hpp"
+#endif
 #include <deque>
 
 #ifndef __COMMON_STUFF__
 #define __COMMON_STUFF__
 
 #define R 5
-#define VERTEX_COUNT (3600)
+#define VERTEX_COUNT (3600)     // index budget of a single bolt, 6 per segment
+#define PAYLOAD_POINTS (4096)  // packed centre line points shared by all bolts in a frame,
+                               // fixed so the State cuttlebone sends is ~46 KB however few are used
+#ifndef MAX_BOLTS
+#define MAX_BOLTS (256)          // live bolts, simulator queue and renderer cache
+#endif
+#define MAX_GEOMETRIES (32)      // bolts whose geometry fits in one frame
+#define BOLT_TABLE (2 * MAX_BOLTS)  // slots of a renderer's bolt id table
+#define KEYFRAME_INTERVAL (15)   // frames between re-sending every bolt's geometry,
+                                 // a new bolt's goes in every frame until the next one
+#define ANIMATION_RATE (60.0)    // frames per second fade and bulge were tuned at
+#define BOLT_LIFETIME (1.5f)     // seconds from a strike until the bolt is retired
 #define N_SAMPLE_PLAYER (5)
 
+#include "bolt_generator.hpp"
+#include "bolt_dbm.hpp"
+#include "bolt_profiler.hpp"
+
+// how bolts travel from the simulator to the renderers:
+//    REPLICATE_GEOMETRY ships the packed centre line of every bolt
+//    REPLICATE_SEED ships a small descriptor and each renderer regenerates
+//                   the same bolt from it
+// simulator and renderer must be built with the same setting
+#define REPLICATE_GEOMETRY 0
+#define REPLICATE_SEED 1
+#ifndef BOLT_REPLICATION
+#define BOLT_REPLICATION REPLICATE_SEED
+#endif
+
+// what happens when more than MAX_BOLTS bolts are struck:
+//    OVERFLOW_DROP_OLDEST retires the oldest bolt to make room
+//    OVERFLOW_DEGRADE strikes simpler bolts once the queue is three quarters
+//                     full, and still drops the oldest when it is full
+#define OVERFLOW_DROP_OLDEST 0
+#define OVERFLOW_DEGRADE 1
+#ifndef BOLT_OVERFLOW
+#define BOLT_OVERFLOW OVERFLOW_DEGRADE
+#endif
+
+// how a bolt is laid out:
+//    MODEL_RANDOM_WALK the displaced random walk of BoltGenerator
+//    MODEL_BREAKDOWN grows it by dielectric breakdown (bolt_dbm.hpp), slower
+//                    and more like real lightning
+// it travels with the BoltSeed, so renderers lay bolts out the same way
+#define MODEL_RANDOM_WALK 0
+#define MODEL_BREAKDOWN 1
+#ifndef BOLT_MODEL
+#define BOLT_MODEL MODEL_RANDOM_WALK
+#endif
+
+// seeds only need to differ between bolts, hashing a counter keeps
+// consecutive strikes from getting similar looking streams
+inline unsigned nextBoltSeed(){
+  static unsigned counter = 0;
+  unsigned x = ++counter * 2654435761u;
+  x ^= x >> 16;
+  return x ? x : 1;
+}
+
+// lightning sprite every bolt is drawn with, built the first time it's asked
+// for. it only needs to be 1 pixel high because it is stretched along the bolt
+inline Texture& boltSprite(){
+  static Texture texture;
+  static bool made = false;
+  if(!made){
+    texture = Texture(256, 1, Graphics::LUMINANCE_ALPHA, Graphics::UBYTE, true);
+    Array& sprite(texture.array());
+    struct{
+      uint8_t l, a;
+    }lum;
+    //texture fading out at the edges
+    for (size_t row = 0; row < sprite.height(); ++row) {
+      for (size_t col = 0; col < sprite.width(); ++col) {
+        float x = float(col) / (sprite.width() - 1) * 2 - 1;
+        // draw lightning, white in the center, and fades out toward the edges
+        // at two rates
+        if (abs(x) < 0.2)
+          lum.l = mapRange(abs(x), 0.f, .2f, 255.f, 60.f);
+        else
+          lum.l = mapRange(abs(x), 0.2f, 1.f, 60.f, 0.f);
+        lum.a = lum.l;
+        sprite.write(&lum.l, col, row);
+      }
+    }
+    made = true;
+  }
+  return texture;
+}
+
+// unit sphere every bulge is drawn with, moved and scaled per bolt
+inline Mesh& bulgeSphere(){
+  static Mesh mesh;
+  if(mesh.vertices().size() == 0){
+    mesh.primitive(Graphics::TRIANGLES);
+    addSphere(mesh, 1, 24, 24);
+    for (int i = 0; i < mesh.vertices().size(); i++){
+      mesh.color(Color(HSV(0.7, 0.5, 1.0), 0.6));
+    }
+    mesh.generateNormals();
+  }
+  return mesh;
+}
+
+// everything makeBolt needs to build a bolt, a renderer that gets this can
+// rebuild exactly the geometry the simulator made, and with the spawn time
+// and nucleus also its whole fade and bulge
+struct BoltSeed {
+  unsigned seed;
+  Vec3f source;
+  Vec3f dest;
+  int maxBranches;
+  float branchProb;
+  float width;
+  int n;
+  double spawnTime;  // simulator time, like State::time
+  Vec3f nucleus;  // nucleus position at the strike, set by BoltPool::spawn
+  int model;      // MODEL_RANDOM_WALK or MODEL_BREAKDOWN
+
+  BoltSeed() : seed(0), model(BOLT_MODEL) {}
+  BoltSeed(Vec3f source, Vec3f dest, int maxBranches, float branchProb,
+           double spawnTime, float width = 0.05, int n = 80)
+    : seed(nextBoltSeed()), source(source), dest(dest), maxBranches(maxBranches),
+      branchProb(branchProb), width(width), n(n), spawnTime(spawnTime),
+      model(BOLT_MODEL) {}
+};
+
+// lay out the bolt s describes into generator with the model it asks for,
+// rng must be seeded from s.seed. returns the number of indices emit() writes
+inline int layOutBolt(BoltGenerator& generator, DbmGenerator& dbm, BoltRandom& rng,
+                      const BoltSeed& s){
+  if(s.model == MODEL_BREAKDOWN){
+    return dbm.generate(generator, rng, s.source, s.dest, s.maxBranches, s.width);
+  }
+  return generator.generate(rng, s.source, s.dest, s.maxBranches, s.branchProb, s.width, s.n);
+}
+
+// sent every frame for every live bolt, geometry is sent separately and
+// only when a bolt is new or a keyframe comes around. fade and bulge follow
+// from State::time, so this is all a renderer needs to keep a bolt alive
+struct BoltUpdate {
+  unsigned id;
+  unsigned version;  // changes whenever the bolt's geometry does
+};
+
+// geometry of one bolt in REPLICATE_SEED mode
+struct SeedBolt {
+  unsigned id;
+  unsigned version;
+  BoltSeed seed;
+};
+
+// one point of a bolt's centre line in REPLICATE_GEOMETRY mode, 10 bytes
+// for what the renderer makes two 36 byte vertices of. the position is
+// quantized inside the bolt's bounding box, the colour is rebuilt from the
+// bolt colour and its fade steps, and the edges from the width: renderers
+// turn the ribbon to face the eye themselves. the indices are rebuilt too,
+// every point is joined to the one before it unless it starts a run
+struct PackedPoint {
+  int16_t x, y, z;  // relative to FlatBolt::center, scaled by halfSize
+  uint16_t t;       // tex coord along the bolt, 0..1
+  uint8_t width;    // half width of the ribbon here, 255 is FlatBolt::width
+  uint8_t first;    // 1 if it starts a run
+};
+
+// geometry of one bolt in REPLICATE_GEOMETRY mode, its centre line is
+// numberOfPoints entries of State::payload starting at offset
 struct FlatBolt {
+  unsigned id;
+  unsigned version;
 	int numberOfPoints;
-	Vec3f points[VERTEX_COUNT];
-  Vec2f textCoe[VERTEX_COUNT];
-  Color color[VERTEX_COUNT];
+  int offset;
+  Vec3f center;
+  Vec3f halfSize;
+  float width;  // widest half width
+  uint8_t color[4];  // RGBA8
   Vec3f ending;
-  Vec3f bulgePosition;
-  Vec3f bulgeScale;
+  double spawnTime;
+  Vec3f nucleus;
 };
 
 struct State {
   	Pose pose;
   	int frame;
+    unsigned run;  // differs between simulator runs, bolt ids start over with each
+    int64_t sent;  // wall clock when it went out, microseconds since the epoch
+    double time;  // simulator clock, seconds since start
   	int numberOfBolts;
-  	FlatBolt flatBolt[5];
+    BoltUpdate update[MAX_BOLTS];
+    int numberOfGeometries;  // bolts whose geometry is in this frame
+#if BOLT_REPLICATION == REPLICATE_SEED
+    SeedBolt seedBolt[MAX_GEOMETRIES];
+#else
+  	FlatBolt flatBolt[MAX_GEOMETRIES];
+    int numberOfPoints;  // used part of payload, recordings keep only that much
+    PackedPoint payload[PAYLOAD_POINTS];  // cuttlebone sends all of it every frame
+#endif
     Vec3f nucleusPose;
+    bool hud;  // renderers show the frame phase bars too
 };
 
 
@@ -67,195 +251,658 @@ class Bolt {
   public:
   Mesh mesh;
   Color color;
-  double strikeTime;
-  double timer;
-  Texture texture;
   Vec3f start;
   Vec3f ending;
-  Mesh bulgeMesh;
-  Vec3f bulgePosition;
-  Vec3f bulgeScale;
+  Color bulgeColor;
+  BoltSeed seed;
+  BoltRandom rng;
+  double spawnTime;
+  Vec3f nucleus;       // bulge origin, the nucleus position at the strike
+  Buffer<float> falloff;  // per vertex, what the fade exponent raises, set with the mesh
+  unsigned id;
+  unsigned version;
+  int geometryRepeats;  // frames left to send this bolt's geometry
+  Vec3f boundCenter;    // a box around the whole ribbon, set with the mesh
+  Vec3f boundHalfSize;
   //float increment;
-  // texture we will write our lightning sprite into
-  // it only needs to be 1 pixel wide because we will repeat the texture side
-  // by side
   Bolt(){
-    strikeTime = 1.5;
-    timer = strikeTime;
     color = Color(1, 0.7, 1, 1);
+    bulgeColor = Color(HSV(0.7, 0.5, 1.0), 0.6);
+    spawnTime = 0;
+    id = 0;
+    version = 0;
+    geometryRepeats = 0;
   }
 
-  void makeTexture(){
-    texture = Texture(256, 1, Graphics::LUMINANCE_ALPHA, Graphics::UBYTE, true);
-    Array& sprite(texture.array());
-    struct{
-      uint8_t l, a;
-    }lum;
-    //texture fading out at the edges   
-    for (size_t row = 0; row < sprite.height(); ++row) {
-      float y = float(row) / (sprite.height() - 1) * 2 - 1;
-      for (size_t col = 0; col < sprite.width(); ++col) {
-        float x = float(col) / (sprite.width() - 1) * 2 - 1;
-        // draw lightning, white in the center, and fades out toward the edges
-        // at two rates
-        if (abs(x) < 0.2)
-          lum.l = mapRange(abs(x), 0.f, .2f, 255.f, 60.f);
-        else
-          lum.l = mapRange(abs(x), 0.2f, 1.f, 60.f, 0.f);
-        lum.a = lum.l;
-        sprite.write(&lum.l, col, row);
-      }
+  // build this bolt from a descriptor, the same descriptor always gives the
+  // same geometry so renderers can regenerate what the simulator made.
+  // renderers ask for RIBBON_FACING
+  void strike(const BoltSeed& s, int ribbon = RIBBON_FLAT){
+    begin(s);
+    if(s.model == MODEL_BREAKDOWN){
+      BoltGenerator& generator = BoltGenerator::shared();
+      layOutBolt(generator, DbmGenerator::shared(), rng, s);
+      generator.emit(mesh, color, ribbon);
+    }else{
+      makeBolt(s.source, s.dest, s.maxBranches, s.branchProb, s.width, s.n, ribbon);
+    }
+    finish();
+  }
+
+  // same, with geometry a BoltWorker already generated from s
+  void strike(const BoltSeed& s, const Mesh& geometry){
+    begin(s);
+    int count = geometry.vertices().size();
+    int indices = geometry.indices().size();
+    mesh.primitive(Graphics::TRIANGLES);
+    if(count > 0){
+      mesh.vertices().append(&geometry.vertices()[0], count);
+      mesh.texCoord2s().append(&geometry.texCoord2s()[0], count);
+    }
+    if(geometry.normals().size() == count && count > 0){
+      mesh.normals().append(&geometry.normals()[0], count);
+    }
+    if(indices > 0){
+      mesh.indices().append(&geometry.indices()[0], indices);
     }
+    mesh.colors().resize(count);
+    for(int i = 0; i < count; i++){
+      mesh.colors()[i] = color;
+    }
+    finish();
+  }
+
+  void begin(const BoltSeed& s){
+    seed = s;
+    rng.reseed(s.seed);
+    start = s.source;
+    ending = s.dest;
+    spawnTime = s.spawnTime;
+    nucleus = s.nucleus;
+    id = s.seed;
+    version++;
+    geometryRepeats = KEYFRAME_INTERVAL;  // packBolts cuts it short at the next keyframe
+    mesh.reset();
   }
 
   // generate a bolt of lightning and add to our mesh
   // modified from Michael Hoffman's
   // (http://gamedevelopment.tutsplus.com/tutorials/how-to-generate-shockingly-good-2d-lightning-effects--gamedev-2681)
+  // branches that would take the bolt past VERTEX_COUNT indices are left out
   void makeBolt(Vec3f source, Vec3f dest, int maxBranches = 0,
-            float branchProb = 0.01, float wid = 0.05, int n = 80) {
-
-    Vec3f tangent = (dest - source);  // direction of lightning
-    Vec3f normal =
-        tangent.cross(Vec3f(0, 0, -1)).normalize();  // normal to lightning
-    float length = tangent.mag();
-
-    // choose n random positions (0,1) along lightning vector and sort them
-    vector<float> positions;
-    positions.push_back(0);
-    for (int i = 0; i < n; i++) positions.push_back(rnd::uniform());
-    sort(positions.begin(), positions.end());
-
-    float sway = 1;  // max random walk step of displacement along normal
-    float jaggedness = 1 / sway;
-
-    Vec3f prevPoint = source;
-    float prevDisplacement = 0;
-   
-    //float width = 0.06; 
-    float width = (wid > 0) ? wid : length / 25.0 + 0.01;
-    //color = Color(1, 0.7, 1, 1);
-    int branches = 0;
+            float branchProb = 0.01, float wid = 0.05, int n = 80,
+            int ribbon = RIBBON_FLAT) {
+    BoltGenerator& generator = BoltGenerator::shared();
+    generator.generate(rng, source, dest, maxBranches, branchProb, wid, n);
+    generator.emit(mesh, color, ribbon);
+  }
+
+  // factor vertex i of count fades with, a vertex is drawn in its mesh
+  // colour times fadeCoefficient ^ fade exponent
+  static double fadeCoefficient(int i, int count){
+    double coe = 0.94 * (i+1) / count;
+    if(coe < 0.45){
+      coe += 0.45;
+    }else if(coe > 0.97){
+      coe = 0.97;
+    }
+    return coe;
+  }
+
+  // what follows from the mesh once it is built: its bounds, and the
+  // falloff of every vertex. the colours stay unfaded, the bolt shaders
+  // fade them from falloff and the exponent BoltSystem::update works out
+  void finish(){
+    bound();
+    int count = mesh.vertices().size();
+    falloff.resize(count);
+    for(int i = 0; i < count; i++){
+      falloff[i] = fadeCoefficient(i, count);
+    }
+  }
+
+  // pack the centre line of a RIBBON_FLAT mesh into payload after the used
+  // points, each point halfway between its two edges. returns false and
+  // leaves payload alone if the bolt doesn't fit
+  bool encode(FlatBolt& flat, PackedPoint* payload, int& used) const {
+    int count = mesh.vertices().size() / 2;
+    if(used + count > PAYLOAD_POINTS) return false;
+
+    const Vec3f* v = count ? &mesh.vertices()[0] : 0;
+    Vec3f lo = count ? (v[0] + v[1]) * 0.5f : Vec3f();
+    Vec3f hi = lo;
+    float widest = 0;
+    for(int k = 0; k < count; k++){
+      Vec3f p = (v[2 * k] + v[2 * k + 1]) * 0.5f;
+      for(int i = 0; i < 3; i++){
+        if(p[i] < lo[i]) lo[i] = p[i];
+        if(p[i] > hi[i]) hi[i] = p[i];
+      }
+      widest = std::max(widest, (v[2 * k] - v[2 * k + 1]).mag() * 0.5f);
+    }
+    flat.id = id;
+    flat.version = version;
+    flat.numberOfPoints = count;
+    flat.offset = used;
+    flat.center = (lo + hi) * 0.5f;
+    flat.halfSize = (hi - lo) * 0.5f;
+    flat.width = widest;
+    Vec3f scale;
+    for(int i = 0; i < 3; i++){
+      scale[i] = flat.halfSize[i] > 0 ? 32767.f / flat.halfSize[i] : 0.f;
+    }
+    float widthScale = widest > 0 ? 255.f / widest : 0.f;
+    flat.color[0] = color.r * 255.f + 0.5f;
+    flat.color[1] = color.g * 255.f + 0.5f;
+    flat.color[2] = color.b * 255.f + 0.5f;
+    flat.color[3] = color.a * 255.f + 0.5f;
+    flat.ending = ending;
+    flat.spawnTime = spawnTime;
+    flat.nucleus = nucleus;
 
+    PackedPoint* out = payload + used;
+    for(int k = 0; k < count; k++){
+      Vec3f p = (v[2 * k] + v[2 * k + 1]) * 0.5f - flat.center;
+      out[k].x = (int16_t)lrintf(p.x * scale.x);
+      out[k].y = (int16_t)lrintf(p.y * scale.y);
+      out[k].z = (int16_t)lrintf(p.z * scale.z);
+      out[k].t = (uint16_t)lrintf(std::min(std::max(mesh.texCoord2s()[2 * k].y, 0.f), 1.f) * 65535.f);
+      out[k].width = (uint8_t)lrintf((v[2 * k] - v[2 * k + 1]).mag() * 0.5f * widthScale);
+      out[k].first = 0;
+    }
+    // segments are indexed in point order, six indices each starting at the
+    // plus edge of their first point, so a point starts a run unless the
+    // next segment starts at the point before it
+    const Buffer<Mesh::Index>& index = mesh.indices();
+    int segments = index.size() / 6;
+    int segment = 0;
+    for(int k = 0; k < count; k++){
+      while(segment < segments && (int)index[segment * 6] / 2 < k - 1) segment++;
+      bool joined = segment < segments && (int)index[segment * 6] / 2 == k - 1;
+      if(!joined) out[k].first = 1;
+    }
+    used += count;
+    return true;
+  }
+
+  // rebuild a RIBBON_FACING mesh from a packed bolt
+  void decode(const FlatBolt& flat, const PackedPoint* payload){
+    mesh.reset();
     mesh.primitive(Graphics::TRIANGLES);
+    int count = flat.numberOfPoints;
+    if(flat.offset < 0 || count < 0 || flat.offset + count > PAYLOAD_POINTS) return;
+
+    Vec3f scale = flat.halfSize / 32767.f;
+    float widthScale = flat.width / 255.f;
+    color = Color(flat.color[0] / 255.f, flat.color[1] / 255.f, flat.color[2] / 255.f, flat.color[3] / 255.f);
+    id = flat.id;
+    version = flat.version;
+    ending = flat.ending;
+    spawnTime = flat.spawnTime;
+    nucleus = flat.nucleus;
+
+    const PackedPoint* in = payload + flat.offset;
+    for(int k = 0; k < count; k++){
+      Vec3f p = flat.center + Vec3f(in[k].x * scale.x, in[k].y * scale.y, in[k].z * scale.z);
+      for(int side = 0; side < 2; side++){
+        mesh.vertex(p);
+        mesh.texCoord(side, in[k].t / 65535.f);
+        mesh.color(color);
+      }
+    }
+    // the direction at each point from its neighbours in the run
+    mesh.normals().resize(2 * count);
+    const Buffer<Vec3f>& v = mesh.vertices();
+    for(int k = 0; k < count; k++){
+      int a = in[k].first ? k : k - 1;
+      int b = k + 1 < count && !in[k + 1].first ? k + 1 : k;
+      Vec3f d = v[2 * b] - v[2 * a];
+      float length = d.mag();
+      d = length > 1e-9f ? d * (in[k].width * widthScale / length) : Vec3f();
+      mesh.normals()[2 * k] = mesh.normals()[2 * k + 1] = d;
+    }
+    for(int k = 1; k < count; k++){
+      if(in[k].first) continue;
+      int j = 2 * k;
+      mesh.index(j - 2);
+      mesh.index(j - 1);
+      mesh.index(j);
+      mesh.index(j);
+      mesh.index(j - 1);
+      mesh.index(j + 1);
+    }
+    finish();
+  }
 
-    Vec3f point;
-
-    for (int i = 1; i < n; i++) {
-      float pos = positions[i];
-
-      // used to prevent sharp angles by ensuring very close positions also have
-      // small perpendicular variation.
-      float scale = (length * jaggedness) * (pos - positions[i - 1]);
-
-      // defines an envelope. Points near the middle of the bolt can be further
-      // from the central line.
-      float envelope = pos > 0.95f ? mapRange(pos, 0.95f, 1.0f, 1.0f, 0.0f) : 1;
-
-      // displacement from prevDisplacement (random walk (brownian motion))
-      float displacement = rnd::uniformS(sway) * scale + prevDisplacement;
-      displacement *= envelope;
-
-      // calculate point, source plus percentage along tangent, and displacement
-      // along normal;
-      point = source + pos * tangent + displacement * normal;
-
-      // generate triangles (vertices and texture coordinates) from point and
-      // prevPoint
-//**********
-      mesh.vertex(prevPoint + normal * width);
-      mesh.vertex(prevPoint - normal * width);
-      mesh.vertex(point + normal * width);
-      mesh.vertex(point + normal * width);
-      mesh.vertex(prevPoint - normal * width);
-      mesh.vertex(point - normal * width);
-      mesh.texCoord(0, (float)(i - 1) / n);
-      mesh.texCoord(1, (float)(i - 1) / n);
-      mesh.texCoord(0, (float)(i) / n);
-      mesh.texCoord(0, (float)(i) / n);
-      mesh.texCoord(1, (float)(i - 1) / n);
-      mesh.texCoord(1, (float)(i) / n);
-      mesh.color(color);
-      mesh.color(color);
-      mesh.color(color);
-      mesh.color(color);
-      mesh.color(color);
-      mesh.color(color);
-//**********
-      if (branches < maxBranches && rnd::prob(branchProb)) {
-        branches++;
-        Vec3f dir(tangent);
-        rotate(dir, Vec3f(0, 0, 1), rnd::uniformS(30) * M_DEG2RAD);
-        dir.normalize();
-        float len = (dest - point).mag();
-        makeBolt(point, point + dir * len * 0.4, maxBranches - 1, branchProb, width * 0.6,
-             n * 0.5);
+  // the box around the mesh's vertices, grown by the widest normal of a
+  // RIBBON_FACING mesh, whose edges can turn any way
+  void bound(){
+    int count = mesh.vertices().size();
+    if(count == 0){
+      boundCenter = boundHalfSize = Vec3f();
+      return;
+    }
+    const Vec3f* v = &mesh.vertices()[0];
+    Vec3f lo = v[0], hi = v[0];
+    for(int j = 1; j < count; j++){
+      for(int i = 0; i < 3; i++){
+        if(v[j][i] < lo[i]) lo[i] = v[j][i];
+        if(v[j][i] > hi[i]) hi[i] = v[j][i];
+      }
+    }
+    float widest = 0;
+    if(mesh.normals().size() == count){
+      for(int j = 0; j < count; j++){
+        widest = std::max(widest, mesh.normals()[j].magSqr());
+      }
+    }
+    widest = std::sqrt(widest);
+    boundCenter = (lo + hi) * 0.5f;
+    boundHalfSize = (hi - lo) * 0.5f + Vec3f(widest, widest, widest);
+  }
+
+  void writeUpdate(BoltUpdate& u) const {
+    u.id = id;
+    u.version = version;
+  }
+
+};
+
+#include "bolt_system.hpp"
+#include "bolt_culling.hpp"
+
+
+// all bolts on one side of the nucleus packed into one mesh, so each side
+// is drawn with one state setup and one draw call however many bolts there
+// are. rebuilt every frame into buffers that keep their capacity. an omni
+// renderer cull()s it for every face, which leaves only that face's bolts
+// in the indices. the colours are unfaded, fade has every vertex's falloff
+// and its bolt's fade exponent for the shader's "fade" attribute
+class BoltBatch {
+  public:
+  Mesh behind;  // bolts whose end faces away from the eye
+  Mesh front;
+  Buffer<Vec2f> fade[2];  // behind, front
+
+  BoltBatch(){
+    behind.primitive(Graphics::TRIANGLES);
+    front.primitive(Graphics::TRIANGLES);
+    culled = false;
+  }
+
+  void reset(){
+    behind.reset();
+    front.reset();
+    for(int side = 0; side < 2; side++){
+      spans[side].reset();
+      fade[side].reset();
+    }
+    culled = false;
+  }
+
+  // bolt faded by exponent, from BoltSystem::fadeExponent
+  void add(const Bolt& bolt, Vec3f eye, Vec3f nucleusP, float exponent){
+    bool away = (eye - nucleusP).dot(bolt.ending - nucleusP) < 0;
+    Mesh& batch = away ? behind : front;
+    const Mesh& mesh = bolt.mesh;
+    int base = batch.vertices().size();
+    int count = mesh.vertices().size();
+    int first = batch.indices().size();
+    int indices = mesh.indices().size();
+    if(count == 0) return;
+    batch.vertices().append(&mesh.vertices()[0], count);
+    batch.texCoord2s().append(&mesh.texCoord2s()[0], count);
+    batch.colors().append(&mesh.colors()[0], count);
+    if(mesh.normals().size() == count){
+      batch.normals().append(&mesh.normals()[0], count);  // RIBBON_FACING
+    }
+    batch.indices().resize(first + indices);
+    Mesh::Index* index = &batch.indices()[first];
+    for(int i = 0; i < indices; i++){
+      index[i] = mesh.indices()[i] + base;
+    }
+    Buffer<Vec2f>& faded = fade[away ? 0 : 1];
+    faded.resize(base + count);
+    for(int i = 0; i < count; i++){
+      faded[base + i] = Vec2f(bolt.falloff[i], exponent);
+    }
+    Span span;
+    span.first = first;
+    span.count = indices;
+    span.center = bolt.boundCenter;
+    span.halfSize = bolt.boundHalfSize;
+    spans[away ? 0 : 1].append(span);
+  }
+
+  // keep in behind and front the triangles of the bolts culler says face
+  // can see, out of all those added since reset()
+  void cull(FaceCuller& culler, int face){
+    for(int side = 0; side < 2; side++){
+      Buffer<Mesh::Index>& index = (side ? front : behind).indices();
+      if(!culled){
+        whole[side].reset();
+        if(index.size() > 0) whole[side].append(&index[0], index.size());
       }
-      // remember previous point and displacement for next iteration
-      prevPoint = point;
-      prevDisplacement = displacement;
-    }
-    //generate last piece
-    mesh.vertex(point + normal * width);
-    mesh.vertex(point - normal * width);
-    mesh.vertex(dest + normal * width);
-    mesh.vertex(dest + normal * width);
-    mesh.vertex(point - normal * width);
-    mesh.vertex(dest - normal * width);
-    mesh.texCoord(0, (float)(n - 1) / n);
-    mesh.texCoord(1, (float)(n - 1) / n);
-    mesh.texCoord(0, (float)(n) / n); //0
-    mesh.texCoord(0, (float)(n) / n); //0
-    mesh.texCoord(1, (float)(n - 1) / n);
-    mesh.texCoord(1, (float)(n) / n); //1
-    mesh.color(color);
-    mesh.color(color);
-    mesh.color(color);
-    mesh.color(color);
-    mesh.color(color);
-    mesh.color(color);
-  }
-
-  void fadeOut(){
-    if(strikeTime - timer > 0.3f){
-      for(int i=0;i<mesh.colors().size();i++){
-        double coe = 0.94 * (i+1) / mesh.colors().size();
-        if(coe < 0.45){
-          coe += 0.45;
-        }else if(coe > 0.97){
-          coe = 0.97;
+      index.reset();
+      for(int i = 0; i < spans[side].size(); i++){
+        const Span& span = spans[side][i];
+        if(culler.visible(face, span.center, span.halfSize)){
+          if(span.count > 0) index.append(&whole[side][span.first], span.count);
+          culler.boltsDrawn++;
+        }else{
+          culler.boltsCulled++;
         }
-        mesh.colors()[i] *= coe; 
       }
     }
+    culled = true;
+  }
+
+#ifndef BOLT_HEADLESS
+  // draw one side with fade as the shader's vertex attribute at location
+  // attribute, -1 when the shader has none
+  void draw(Graphics& g, bool frontSide, int attribute){
+    Mesh& mesh = frontSide ? front : behind;
+    Buffer<Vec2f>& faded = fade[frontSide ? 1 : 0];
+    if(attribute >= 0 && faded.size() > 0){
+      glEnableVertexAttribArray(attribute);
+      glVertexAttribPointer(attribute, 2, GL_FLOAT, GL_FALSE, 0, &faded[0]);
+    }
+    g.draw(mesh);
+    if(attribute >= 0) glDisableVertexAttribArray(attribute);
+  }
+#endif
+
+  private:
+  // a bolt's indices in whole[] and its bounds
+  struct Span {
+    int first;
+    int count;
+    Vec3f center;
+    Vec3f halfSize;
+  };
+  Buffer<Span> spans[2];               // behind, front
+  Buffer<Mesh::Index> whole[2];        // every bolt's indices, once cull() has started
+  bool culled;
+};
+
+#include "bolt_worker.hpp"
+
+// every bolt the simulator will use, allocated once. live bolts sit in the
+// order they were struck in a BoltSystem, so spawning and retiring never touch the heap and
+// a recycled bolt keeps the storage its meshes already grew
+class BoltPool {
+  public:
+  Bolt storage[MAX_BOLTS];
+  BoltSystem live;         // live bolts, the oldest at live.head
+  Bolt* spare[MAX_BOLTS];  // free bolts, used as a stack
+  int spares;
+  BoltWorker* worker;  // when set and started, strikes are generated there
+
+  BoltPool() : spares(MAX_BOLTS), worker(0) {
+    for(int i = 0; i < MAX_BOLTS; i++){
+      spare[i] = &storage[i];
+    }
   }
-  void countDown(double dt){
-    timer -= dt;
+
+  int size() const { return live.size(); }
+
+  // i-th live bolt, in BoltSystem order
+  Bolt* operator[](int i) const { return live.bolt[i]; }
+
+  // strike a new bolt, when every bolt is live the oldest one is recycled.
+  // with a worker the bolt shows up in a later collect() and this returns 0
+  Bolt* spawn(BoltSeed s, Vec3f nucleusP){
+#if BOLT_OVERFLOW == OVERFLOW_DEGRADE
+    if(live.size() >= MAX_BOLTS * 3 / 4){
+      s.maxBranches = std::min(s.maxBranches, 1);
+      s.n = std::max(s.n / 2, 8);
+    }
+#endif
+    s.nucleus = nucleusP;
+    if(worker && worker->started() && worker->request(s)){
+      return 0;
+    }
+    Bolt* bolt = take();
+    bolt->strike(s);
+    live.add(bolt);
+    return bolt;
   }
 
-  void createBulge(Vec3f nucleusP){
-    bulgeScale = Vec3f(0.035, 0.035, 0.035);
-    bulgePosition = (ending - nucleusP) * 0.6f + nucleusP;
-    mesh.primitive(Graphics::TRIANGLES); 
-    addSphere(bulgeMesh);
-    for (int i = 0; i < bulgeMesh.vertices().size(); i++){
-      bulgeMesh.color(Color(HSV(0.7, 0.5, 1.0), 0.6));
+  // bring in the strikes the worker has finished, oldest first. they strike
+  // now, simulator time, not when they were asked for, so they get their
+  // whole lifetime however long the worker took
+  void collect(double now){
+    if(!worker) return;
+    while(const BoltWorker::Job* job = worker->ready()){
+      BoltSeed s = job->seed;
+      s.spawnTime = now;
+      Bolt* bolt = take();
+      bolt->strike(s, job->mesh);
+      live.add(bolt);
+      worker->release();
     }
-    bulgeMesh.generateNormals();
   }
 
-  void bulge(Vec3f nucleusP){
-    Vec3f destination = 0.03f * (ending - nucleusP) + bulgePosition;
-    if(timer > 1.15f) {//前0.25秒
-      bulgePosition += 0.5f * (destination - bulgePosition);
-    }else{//之后
-      bulgePosition +=  0.007f * (nucleusP - ending);
-      bulgeScale += Vec3f(0.0002, 0.0002, 0.0002); 
-      if(bulgeScale.x > 0.07f){
-        bulgeScale = Vec3f(0.07f, 0.07f, 0.07f);
+  // bring fade, bulge and timer of every live bolt to the simulator time now
+  void animate(double now){
+    live.update(now);
+  }
+
+  // take back the bolts that have faded out wherever they are, the others
+  // keep their order
+  void retireExpired(){
+    spares += live.retireExpired(spare + spares);
+  }
+
+  private:
+  // a free bolt, or the oldest live one when there is none, whose place in
+  // live the next add() takes
+  Bolt* take(){
+    if(spares > 0){
+      return spare[--spares];
+    }
+    return live.oldest();
+  }
+};
+
+// the simulator's half of a frame: every live bolt's update, and geometry
+// for new bolts in every frame up to the next keyframe and, on keyframes,
+// for all of them, so a renderer that missed some States or started late
+// catches up within KEYFRAME_INTERVAL frames. geometry that doesn't fit
+// waits for the next frame
+inline void packBolts(State& state, BoltPool& pool){
+  PROFILE("pack");
+  bool keyframe = state.frame % KEYFRAME_INTERVAL == 0;
+  state.numberOfBolts = 0;
+  state.numberOfGeometries = 0;
+#if BOLT_REPLICATION == REPLICATE_GEOMETRY
+  state.numberOfPoints = 0;
+#endif
+  for(int i = 0; i < pool.size(); i++){
+    Bolt* bolt = pool[i];
+    if(state.numberOfBolts == MAX_BOLTS){
+      break;
+    }
+    bolt->writeUpdate(state.update[state.numberOfBolts++]);
+    if(keyframe){
+      bolt->geometryRepeats = 1;
+    }
+    if(bolt->geometryRepeats > 0 && state.numberOfGeometries < MAX_GEOMETRIES){
+      int g = state.numberOfGeometries;
+#if BOLT_REPLICATION == REPLICATE_SEED
+      state.seedBolt[g].id = bolt->id;
+      state.seedBolt[g].version = bolt->version;
+      state.seedBolt[g].seed = bolt->seed;
+#else
+      if(!bolt->encode(state.flatBolt[g], state.payload, state.numberOfPoints)){
+        continue;
       }
+#endif
+      state.numberOfGeometries++;
+      bolt->geometryRepeats--;
+    }
+  }
+}
+
+// a renderer's copy of the simulator's live bolts. bolts[] is keyed by bolt
+// id, a bolt keeps its entry for as long as it shows up in the state's
+// update list. the live entries are found by id through an open addressed
+// table, rebuilt once a sync, and a new simulator run drops them all
+class BoltCache {
+  public:
+  Bolt bolts[MAX_BOLTS];
+  bool live[MAX_BOLTS];
+  BoltSystem animated;  // the live entries of bolts[], refilled every frame
+  BoltWorker* worker;   // when set and started, breakdown bolts are laid out there
+
+  BoltCache() : worker(0), run(0) {
+    for(int i = 0; i < MAX_BOLTS; i++){
+      bolts[i].mesh.primitive(Graphics::TRIANGLES);
+      live[i] = false;
     }
+    index();
   }
 
+  // the renderer's half of a frame, sync() then animate() at the state's
+  // own time
+  void unpack(const State& state){
+    sync(state);
+    animate(state.time);
+  }
+
+  // drop the bolts that left the update list and rebuild new ones or new
+  // versions of one. bolts we have no geometry for yet show up after the
+  // next keyframe, breakdown bolts given to the worker once it is done
+  void sync(const State& state){
+    PROFILE("unpack");
+    if(state.run != run){
+      // a new simulator, its ids mean other bolts
+      run = state.run;
+      for(int k = 0; k < MAX_BOLTS; k++){
+        live[k] = false;
+      }
+      index();
+    }
+    for(int k = 0; k < MAX_BOLTS; k++){
+      listed[k] = false;
+    }
+    for(int i = 0; i < state.numberOfBolts && i < MAX_BOLTS; i++){
+      int k = find(state.update[i].id);
+      if(k >= 0) listed[k] = true;
+    }
+    for(int k = 0; k < MAX_BOLTS; k++){
+      live[k] = listed[k];
+    }
+    index();
+    collect(state);
+    for(int g = 0; g < state.numberOfGeometries && g < MAX_GEOMETRIES; g++){
+#if BOLT_REPLICATION == REPLICATE_SEED
+      const SeedBolt& geometry = state.seedBolt[g];
+#else
+      const FlatBolt& geometry = state.flatBolt[g];
+#endif
+      int k = find(geometry.id);
+      if(k >= 0 && bolts[k].version == geometry.version) continue;
+#if BOLT_REPLICATION == REPLICATE_SEED
+      // the old version, if any, stays until the worker has the new one
+      if(geometry.seed.model == MODEL_BREAKDOWN && worker && worker->started()){
+        if(!worker->queued(geometry.id, geometry.version)){
+          worker->request(geometry.seed, geometry.version);
+        }
+        continue;
+      }
+#endif
+      k = entryFor(geometry.id);
+      if(k < 0) continue;
+#if BOLT_REPLICATION == REPLICATE_SEED
+      bolts[k].strike(geometry.seed, RIBBON_FACING);
+      bolts[k].id = geometry.id;
+      bolts[k].version = geometry.version;
+#else
+      bolts[k].decode(geometry, state.payload);
+#endif
+      live[k] = true;
+    }
+    animated.clear();
+    for(int k = 0; k < MAX_BOLTS; k++){
+      if(live[k]) animated.add(&bolts[k]);
+    }
+  }
+
+  // bring the live bolts' fade and bulges to simulator time, which need
+  // not be a state's: the renderer draws between them
+  void animate(double time){
+    animated.update(time);
+  }
+
+  // the live entry with id, -1 if there is none
+  int find(unsigned id) const {
+    for(unsigned h = id % BOLT_TABLE; table[h] >= 0; h = (h + 1) % BOLT_TABLE){
+      if(bolts[table[h]].id == id) return table[h];
+    }
+    return -1;
+  }
+
+  private:
+  unsigned run;                // State::run the entries came from
+  int table[BOLT_TABLE];       // entries of the live ids, -1 where empty
+  int spare[MAX_BOLTS];        // entries that aren't live
+  int spares;
+  bool listed[MAX_BOLTS];
+
+  // the table and spares from live[]
+  void index(){
+    for(int h = 0; h < BOLT_TABLE; h++){
+      table[h] = -1;
+    }
+    spares = 0;
+    for(int k = MAX_BOLTS - 1; k >= 0; k--){
+      if(live[k]) enter(k);
+      else spare[spares++] = k;
+    }
+  }
+
+  void enter(int k){
+    unsigned h = bolts[k].id % BOLT_TABLE;
+    while(table[h] >= 0) h = (h + 1) % BOLT_TABLE;
+    table[h] = k;
+  }
+
+  // id's entry, or a spare one for it. -1 if every entry is live
+  int entryFor(unsigned id){
+    int k = find(id);
+    if(k >= 0 || spares == 0) return k;
+    k = spare[--spares];
+    bolts[k].id = id;
+    enter(k);
+    return k;
+  }
+
+  // bring in the bolts the worker has finished that are still in state's
+  // update list, the others went while they were being laid out
+  void collect(const State& state){
+    if(!worker) return;
+    while(const BoltWorker::Job* job = worker->ready()){
+      unsigned id = job->seed.seed;
+      bool listed = false;
+      for(int i = 0; i < state.numberOfBolts && i < MAX_BOLTS && !listed; i++){
+        listed = state.update[i].id == id && state.update[i].version == job->tag;
+      }
+      int k = listed ? entryFor(id) : -1;
+      if(k >= 0){
+        bolts[k].strike(job->seed, job->mesh);
+        bolts[k].id = id;
+        bolts[k].version = job->tag;
+        live[k] = true;
+      }
+      worker->release();
+    }
+  }
 };
 
+#include "bolt_telemetry.hpp"
+#include "bolt_recording.hpp"
+#include "bolt_transport.hpp"
+#include "bolt_interpolation.hpp"
+
 #endif
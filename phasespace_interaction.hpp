@@ -13,14 +13,14 @@ struct PS {
   Nav *mNav;
   float sensitivity;
 
-  std::deque<Bolt*> *boltQ;
+  BoltPool *boltQ;
   State *state;
   gam::SamplePlayer<> *samplePlayer;
   int *currentPlayer;
 
   PS(): sensitivity(10.0) {}
 
-  void init(Nav *nav, State *s, std::deque<Bolt*> *importBoltQ, gam::SamplePlayer<> *samplePlayerN, int *currentPlayerC){
+  void init(Nav *nav, State *s, BoltPool *importBoltQ, gam::SamplePlayer<> *samplePlayerN, int *currentPlayerC){
     tracker = Phasespace::master();
     tracker->start();
     right.monitorMarkers(tracker->markers,0);
@@ -32,7 +32,7 @@ struct PS {
     currentPlayer = currentPlayerC;
   }
 
-  void initTest(Nav *nav, State *s, std::deque<Bolt*> *importBoltQ, gam::SamplePlayer<> *samplePlayerN, int *currentPlayerC){
+  void initTest(Nav *nav, State *s, BoltPool *importBoltQ, gam::SamplePlayer<> *samplePlayerN, int *currentPlayerC){
     tracker = Phasespace::master();
     tracker->startPlaybackFile("phasespace/marker-data/gloves.txt");
     right.monitorMarkers(tracker->markers,0);
@@ -87,13 +87,7 @@ struct PS {
       float t = ray.intersectSphere(Vec3f(0,0,0), R);
       Vec3f src = ray(t);
       Vec3f dest = 0.1f * (src - center).normalize() + center;
-      Bolt* newPSBolt = new Bolt();
-      newPSBolt->makeTexture();
-      newPSBolt->start = src;
-      newPSBolt->ending = dest;
-      newPSBolt->makeBolt(src, dest, 2, 0.03);
-      newPSBolt->createBulge(center);
-      boltQ->push_back(newPSBolt); 
+      boltQ->spawn(BoltSeed(src, dest, 2, 0.03, state->time), center);
     }
 
     // state->cursor.set(nav().pos() + pos);
@@ -0,0 +1,134 @@
+#ifndef __PLASMA_SIMULATION__
+#define __PLASMA_SIMULATION__
+
+// The simulator without its window, audio and PhaseSpace
+//
+// PlasmaSimulation is what simulator_4.cpp does every frame to the plasma
+// ball: strike at random intervals, wiggle the nucleus, bring the bolts
+// the worker finished in, animate and retire them, and pack the State the
+// renderers get. The app wraps it with drawing, sound and gloves;
+// simulator_headless.cpp runs it on its own for soak and load tests, with
+// SimulatedPinches standing in for the gloves.
+//
+// A frame is advance(), then any pinches, then settle() and pack().
+
+#include "common_4.hpp"
+
+class PlasmaSimulation {
+  public:
+  double time;        // since the last strike
+  double pace;        // seconds from the last strike to the next
+  double upperbound;  // longest pace, '=' and '-' on the simulator change it
+  Vec3f center;
+  Vec3f nucleusPose;
+  Vec3f affection;
+  BoltPool boltQ;
+  BoltWorker worker;
+  BoltRandom rng;  // where strikes land, and when
+  State state;
+
+  PlasmaSimulation(uint64_t seed = 1) : rng(seed) {
+    time = 0;
+    pace = 1.0;
+    upperbound = 2.5;
+    center = Vec3f(0, 0.6, -1);
+    nucleusPose = center;
+    state.frame = 0;
+    state.run = (unsigned)wallMicros();
+    state.time = 0;
+    state.sent = 0;
+    state.hud = false;
+    boltQ.worker = &worker;
+  }
+
+  // move the clocks on by dt, and strike when the pace is up. returns
+  // whether it struck, which is when the app plays its spark
+  bool advance(double dt){
+    time += dt;
+    state.time += dt;
+
+    if (time <= pace) {
+      nucleusPose = center;
+      return false;
+    }
+    PROFILE("strike");
+    //wiggle
+    nucleusPose += Vec3f(rng.uniformS(0.006), rng.uniformS(0.006), rng.uniformS(0.006));
+
+    //generate starting and ending point
+    float z = 4.7f * rng.uniformS();
+    float y = R * rng.uniformS();
+    float x;
+    if(R*R - z*z - y*y<=0){
+      x = 0.f;
+    }else {
+      x = sqrt(R*R - z*z - y*y);
+    }
+    float sign = rng.uniformS() <= 0 ? -1 : 1;
+    Vec3f source = Vec3f(sign * x, y, z);
+    Vec3f dest = (source - center).normalize() * 0.1f + center;
+    affection = (source - center).normalize() * 0.1;
+    boltQ.spawn(BoltSeed(source, dest, 4, 0.06, state.time), nucleusPose);
+    //reset time and pace
+    time = 0;
+    pace = rng.uniform() * upperbound;
+    return true;
+  }
+
+  // the strike a pinch makes, from source on the shell to the nucleus
+  void pinch(Vec3f source){
+    Vec3f dest = 0.1f * (source - center).normalize() + center;
+    boltQ.spawn(BoltSeed(source, dest, 2, 0.03, state.time), center);
+  }
+
+  void settle(){
+    //strikes the worker has finished join the others
+    {
+      PROFILE("collect");
+      boltQ.collect(state.time);
+    }
+    //fade out all the bolts and move their bulges, in one pass over the
+    //live bolts' state
+    {
+      PROFILE("animate");
+      boltQ.animate(state.time);
+    }
+    //give back the ones already disappear, wherever they are
+    boltQ.retireExpired();
+  }
+
+  // the State for this frame, seen from pose, into out. every live bolt
+  // gets a small update each frame, geometry only goes out for new bolts
+  // and on keyframes so late renderers can catch up. the caller sends it,
+  // then moves state.frame on
+  State& pack(const Pose& pose, bool hud, State& out){
+    out.frame = state.frame;
+    out.run = state.run;
+    out.time = state.time;
+    packBolts(out, boltQ);
+    out.nucleusPose = nucleusPose;
+    out.hud = hud;
+    out.pose = pose;
+    return out;
+  }
+
+  State& pack(const Pose& pose, bool hud){ return pack(pose, hud, state); }
+};
+
+// an audience member who pinches perSecond times a second on average, each
+// time at a random spot of the shell in front of them
+class SimulatedPinches {
+  public:
+  float perSecond;
+  BoltRandom rng;
+
+  SimulatedPinches(float perSecond = 0.5f, uint64_t seed = 2) : perSecond(perSecond), rng(seed) {}
+
+  void step(double dt, PlasmaSimulation& simulation){
+    if(!rng.prob(perSecond * dt)) return;
+    Vec3f toward(rng.uniformS(), rng.uniformS(0.5f), -1);
+    simulation.pinch(toward.normalize() * (float)R);
+  }
+};
+
+#endif
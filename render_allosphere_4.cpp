@@ -58,40 +58,38 @@ struct AlloApp : OmniStereoGraphicsRenderer {
   Mesh nucleus;
   Mesh shell;
   //lightning bolts and bulges
-  Mesh bolts[5];
-  Mesh bulge[5];
-  Vec3f endingPositions[5];
-  Vec3f bulgeScale[5];
-  Vec3f bulgePosition[5];
-  Texture texture;
+  BoltCache cache;
+  BoltWorker worker;  // lays out breakdown bolts off the render thread
+  // one instance of bulgeSphere() per live bolt, xyz position and w scale
+  Vec4f bulgeInstance[MAX_BOLTS];
+  Color bulgeTint[MAX_BOLTS];
+  int bulges;
+  Vec4f faceInstance[MAX_BOLTS];  // the bulges the face being drawn sees
+  Color faceTint[MAX_BOLTS];
+  BoltBatch batch;
+  FaceCuller culler;  // which bolts and bulges each omni face draws
+  bool culling;
+  ProfileHud hud;  // shown while the simulator shows its own
+  ReceiveTelemetry telemetry;  // how the states arrive, logged every second
 
   cuttlebone::Taker<State> taker;  // XXX
+  StateReplay replay;  // takes the taker's place when it is open
+  Transport transport;
+  SharedStateReader shared;  // with --transport shm, read in place
+  StateHistory history;  // recent States, to draw between them
+  bool smooth;  // draw between States rather than each as it comes
   State state;                     // XXX
 
   AlloApp() {
 
-    texture = Texture(256, 1, Graphics::LUMINANCE_ALPHA, Graphics::UBYTE, true);
-    Array& sprite(texture.array());
-    struct{
-      uint8_t l, a;
-    }lum;
-    //texture fading out at the edges   
-    for (size_t row = 0; row < sprite.height(); ++row) {
-      float y = float(row) / (sprite.height() - 1) * 2 - 1;
-      for (size_t col = 0; col < sprite.width(); ++col) {
-        float x = float(col) / (sprite.width() - 1) * 2 - 1;
-        // draw lightning, white in the center, and fades out toward the edges at two rates
-        if (abs(x) < 0.2)
-          lum.l = mapRange(abs(x), 0.f, .2f, 255.f, 60.f);
-        else
-          lum.l = mapRange(abs(x), 0.2f, 1.f, 60.f, 0.f);
-        lum.a = lum.l;
-        sprite.write(&lum.l, col, row);
-      }
-    }
-    for(int i = 0; i < 5; i++){
-      bolts[i].primitive(Graphics::TRIANGLES);
-    }
+    bulges = 0;
+    transport = TRANSPORT_UDP;
+    smooth = true;
+    culling = true;
+    worker.ribbon = RIBBON_FACING;
+    cache.worker = &worker;
+    PROFILE_THREAD("render");
+    telemetry.open(("renderer_telemetry_" + hostName() + ".csv").c_str());
 
     //add nucleus and shell
     addSphere(nucleus, 0.1, 64, 64);
@@ -105,16 +103,6 @@ struct AlloApp : OmniStereoGraphicsRenderer {
     }
     shell.generateNormals();
 
-    //add bulges
-    for(int i = 0; i < 5; i++){
-      bulge[i].primitive(Graphics::TRIANGLES); 
-      addSphere(bulge[i], 1, 24, 24);
-      for (int j = 0; j < bulge[i].vertices().size(); i++){
-        bulge[j].color(Color(HSV(0.7, 0.5, 1.0), 0.6));
-      }
-      bulge[i].generateNormals();
-    }
-
     //settings
     //nav().pos(0, 0.5, 2);
     light.pos(10, 10, 10);
@@ -129,19 +117,24 @@ struct AlloApp : OmniStereoGraphicsRenderer {
   }
 
   virtual void onDraw(Graphics& g) {
+    PROFILE("onDraw");
+    // only what this cube face sees, this is called for each face and eye
+    int face = omni().face();
+    if (culling) {
+      culler.passes++;
+      batch.cull(culler, face);
+    }
 
     //draw behind lightnings 
     g.depthTesting(false);
     g.blending(true); 
     g.blendModeTrans();
     shader().uniform("texture", 1.0);
-    for(int i = 0; i < 5 && i < state.numberOfBolts ; i++){
-      if ((pose.pos() - nucleusPose).dot(endingPositions[i] - nucleusPose) < 0) {
-        texture.bind();
-        g.draw(bolts[i]);
-        texture.unbind();
-      }
-    }
+    shader().uniform("ribbon", 1.0);
+    boltSprite().bind();
+    batch.draw(g, false, shader().attribute("fade"));
+    boltSprite().unbind();
+    shader().uniform("ribbon", 0.0);
     shader().uniform("texture", 0.0);
 
     material();
@@ -162,26 +155,18 @@ struct AlloApp : OmniStereoGraphicsRenderer {
     g.blending(true);
     g.blendModeTrans();
     shader().uniform("texture", 1.0);
-    for(int i = 0; i < 5 && i < state.numberOfBolts ; i++){
-      if ((pose.pos() - nucleusPose).dot(endingPositions[i] - nucleusPose) >= 0) { 
-        texture.bind();
-        g.draw(bolts[i]);
-        texture.unbind();
-      }
-    }
+    shader().uniform("ribbon", 1.0);
+    boltSprite().bind();
+    batch.draw(g, true, shader().attribute("fade"));
+    boltSprite().unbind();
+    shader().uniform("ribbon", 0.0);
     shader().uniform("texture", 0.0);
 
     //bulge
     g.depthTesting(true);
     g.blending(false);
     shader().uniform("lighting", 0.7);
-    for(int i = 0; i < 5 && i < state.numberOfBolts ; i++){
-      g.pushMatrix();
-        g.translate(bulgePosition[i]);
-        g.scale(bulgeScale[i]);
-        g.draw(bulge[i]);
-      g.popMatrix();
-    }
+    drawBulges(face);
     shader().uniform("lighting", 0.0);
 
     //draw shell
@@ -189,44 +174,155 @@ struct AlloApp : OmniStereoGraphicsRenderer {
     // g.blending(true);
     // g.blendModeTrans();
     // g.draw(shell);
+
+    //frame phase timings, lighting and texture are already off
+    if (hud.visible) {
+      g.depthTesting(false);
+      g.blending(false);
+      g.draw(hud.mesh);
+    }
   }
 
   virtual void onAnimate(double dt) {
-    taker.get(state); // XXX
+    PROFILE("onAnimate");
+    // the frame to draw, in shared memory it stays in the simulator's slot
+    const State* current = &state;
+    int fresh = 0;
+    {
+      PROFILE("taker.get");
+      if (replay.opened()) {
+        fresh = replay.get(state);
+      } else if (transport == TRANSPORT_SHARED) {
+        // the simulator may not have started yet
+        if (shared.opened() || shared.open()) {
+          telemetry.taking();
+          fresh = shared.take(current);
+          telemetry.received(*current, fresh);
+        }
+      } else {
+        telemetry.taking();
+        fresh = taker.get(state); // XXX
+        telemetry.received(state, fresh);
+      }
+    }
 
-    //nucleus
-    nucleusPose = state.nucleusPose;
-    pose = state.pose;
-  
     //lightning
-    for(int i = 0; i <state.numberOfBolts && i < 5; i++){
-      bolts[i].reset();
-      endingPositions[i] = Vec3f(0,0,0);
-      for(int j = 0; j< state.flatBolt[i].numberOfPoints && j < VERTEX_COUNT; j++){
-        bolts[i].vertex(state.flatBolt[i].points[j]);
-        bolts[i].texCoord(state.flatBolt[i].textCoe[j]);
-        bolts[i].color(state.flatBolt[i].color[j]);
-      }
-      if(state.flatBolt[i].numberOfPoints > VERTEX_COUNT){
-          cout<< "bigger number appear for numberOfPoints: " << state.flatBolt[i].numberOfPoints << endl;
+    if (fresh > 0) {
+      cache.sync(*current);
+      history.add(*current, steadySeconds());
+    }
+    //nucleus and viewer, and the bolts, at the moment between States this
+    //frame shows, or as the State has them
+    double time = current->time;
+    nucleusPose = current->nucleusPose;
+    pose = current->pose;
+    if (smooth) history.at(steadySeconds(), time, pose, nucleusPose);
+    cache.animate(time);
+    // last frame's faces, then where this frame's look from
+    telemetry.drew(culler);
+    culler.look(pose, lens().eyeSep());
+    // one mesh per side of the nucleus, every omni face draws its part of them
+    const BoltSystem& live = cache.animated;
+    {
+      PROFILE("batch");
+      batch.reset();
+      bulges = live.size();
+      for(int i = 0; i < bulges; i++){
+        batch.add(*live.bolt[i], pose.pos(), nucleusPose, live.fadeExponent[i]);
+        bulgeInstance[i] = Vec4f(live.bulgeX[i], live.bulgeY[i], live.bulgeZ[i], live.bulgeScale[i]);
+        bulgeTint[i] = live.bolt[i]->bulgeColor;
       }
-      endingPositions[i] = state.flatBolt[i].ending;
     }
-    //bulges
-    for(int i = 0 ; i < state.numberOfBolts && i < 5; i++){
-      bulgeScale[i] = state.flatBolt[i].bulgeScale;
-      bulgePosition[i] = state.flatBolt[i].bulgePosition;
+
+    hud.visible = current->hud;
+    hud.update();
+    hud.build(pose);
+  }
+
+  // space steps a replay started with --step
+  virtual bool onKeyDown(const Keyboard& k) {
+    if (k.key() == ' ') replay.step();
+    return true;
+  }
+
+  // every bulge face sees in one instanced draw of the shared sphere, the
+  // vertex shader places each instance from its instance attributes
+  void drawBulges(int face){
+    PROFILE("bulges");
+    int shown = 0;
+    for(int i = 0; i < bulges; i++){
+      const Vec4f& b = bulgeInstance[i];
+      if(culling && !culler.visible(face, Vec3f(b[0], b[1], b[2]), b[3])){
+        culler.bulgesCulled++;
+        continue;
+      }
+      faceInstance[shown] = b;
+      faceTint[shown] = bulgeTint[i];
+      shown++;
     }
+    if(culling) culler.bulgesDrawn += shown;
+    if(shown == 0) return;
+    GLint instance = shader().attribute("instance");
+    GLint instanceColor = shader().attribute("instanceColor");
+    if(instance < 0 || instanceColor < 0) return;
+    Mesh& sphere = bulgeSphere();
+
+    shader().uniform("instanced", 1.0);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, &sphere.vertices()[0]);
+    glNormalPointer(GL_FLOAT, 0, &sphere.normals()[0]);
+    glEnableVertexAttribArray(instance);
+    glVertexAttribPointer(instance, 4, GL_FLOAT, GL_FALSE, 0, faceInstance);
+    glVertexAttribDivisor(instance, 1);
+    glEnableVertexAttribArray(instanceColor);
+    glVertexAttribPointer(instanceColor, 4, GL_FLOAT, GL_FALSE, 0, faceTint);
+    glVertexAttribDivisor(instanceColor, 1);
+
+    glDrawElementsInstanced(GL_TRIANGLES, sphere.indices().size(), GL_UNSIGNED_INT,
+                            &sphere.indices()[0], shown);
+
+    glVertexAttribDivisor(instance, 0);
+    glVertexAttribDivisor(instanceColor, 0);
+    glDisableVertexAttribArray(instance);
+    glDisableVertexAttribArray(instanceColor);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    shader().uniform("instanced", 0.0);
   }
 
 inline std::string vertexCode() {
   // XXX use c++11 string literals
   return R"(
+uniform float instanced;
+uniform float ribbon;          // bolts, RIBBON_FACING meshes
+attribute vec4 instance;       // xyz position, w scale
+attribute vec4 instanceColor;
+attribute vec2 fade;           // bolts, falloff and fade exponent
 varying vec4 color;
 varying vec3 normal, lightDir, eyeVec;
 void main() {
   color = gl_Color;
-  vec4 vertex = gl_ModelViewMatrix * gl_Vertex;
+  vec4 position = gl_Vertex;
+  if (instanced > 0.0) {
+    position = vec4(gl_Vertex.xyz * instance.w + instance.xyz, 1.0);
+    color = instanceColor;
+  }
+  vec4 vertex = gl_ModelViewMatrix * position;
+  if (ribbon > 0.0) {
+    // the mesh colour is unfaded, the fade is done here for every vertex
+    color = gl_Color * pow(fade.x, fade.y);
+    // both edges sit on the centre line with the bolt's direction, as long
+    // as the half width, for a normal. move them apart across it and the
+    // line of sight, for every face and eye, s says which edge
+    vec3 along = (gl_ModelViewMatrix * vec4(gl_Normal, 0.0)).xyz;
+    vec3 across = cross(along, vertex.xyz);
+    float size = length(across);
+    if (size > 0.0) {
+      float side = 1.0 - 2.0 * gl_MultiTexCoord0.s;
+      vertex.xyz += across * (length(along) * side / size);
+    }
+  }
   normal = gl_NormalMatrix * gl_Normal;
   vec3 V = vertex.xyz;
   eyeVec = normalize(-V);
@@ -270,8 +366,42 @@ void main() {
 
 };
 
-int main() {
+// render_allosphere_4 [--transport udp | shm] [--replay FILE [--fast | --step] [--once]]
+//                     [--no-smoothing] [--no-culling]
+// shm reads the States a simulator on this machine shares instead of
+// listening for its broadcast. --replay plays a recording (BOLT_RECORD on
+// the simulator) instead of either: at the speed it was recorded, a frame
+// per frame drawn with --fast, or a frame per space bar with --step. it
+// loops unless --once. --no-smoothing draws each State as it comes instead
+// of between them, --fast and --step always do. --no-culling draws every
+// bolt and bulge on every omni face
+int main(int argc, char* argv[]) {
   AlloApp app;
-  app.taker.start();  // XXX
+  for (int i = 1; i < argc; i++) {
+    string flag = argv[i];
+    if (flag == "--replay" && i + 1 < argc) {
+      if (!app.replay.open(argv[++i])) return 1;
+    } else if (flag == "--fast") {
+      app.replay.mode = REPLAY_FAST;
+      app.smooth = false;
+    } else if (flag == "--step") {
+      app.replay.mode = REPLAY_STEP;
+      app.smooth = false;
+    } else if (flag == "--no-smoothing") {
+      app.smooth = false;
+    } else if (flag == "--no-culling") {
+      app.culling = false;
+    } else if (flag == "--once") {
+      app.replay.loop = false;
+    } else if (flag == "--transport" && i + 1 < argc && parseTransport(argv[i + 1], app.transport)) {
+      i++;
+    } else {
+      cerr << "unknown option " << flag << endl;
+      return 1;
+    }
+  }
+  if (!app.replay.opened() && app.transport == TRANSPORT_UDP) app.taker.start();  // XXX
+  Profiler::traceOnExit();  // BOLT_TRACE=file saves the frame phases at exit
+  app.worker.start();
   app.start();
 }
@@ -57,43 +57,54 @@ using namespace al;
 using namespace std;
 
 #include "common_4.hpp"
+#include "plasma_simulation.hpp"
 #include "phasespace_interaction.hpp"
 
-void printFactsAboutState(int size);
 
 struct AlloApp : App, AlloSphereAudioSpatializer, InterfaceServerClient {
-  double time;
-  double pace;
-  double upperbound;
+  PlasmaSimulation sim;  // strikes, bolts and the State, everything but I/O
   Material material;
   Light light;
-  Vec3f center;
-  Vec3f nucleusPose;
-  Vec3f affection;
   Mesh nucleus;
   Mesh shell;
-  std::deque<Bolt*> boltQ;
+  BoltBatch batch;
+  // one instance of bulgeSphere() per live bolt on each side of the nucleus,
+  // behind and front, xyz position and w scale
+  Vec4f bulgeInstance[2][MAX_BOLTS];
+  Color bulgeTint[2][MAX_BOLTS];
+  int bulges[2];
+  ShaderProgram boltShader;   // fades and textures the bolt batches
+  ShaderProgram bulgeShader;  // places and lights the bulge instances
+  bool shadersBuilt;
+  ProfileHud hud;  // 'h' shows frame phase timings here and on the renderers
+  SendTelemetry telemetry;  // what the broadcast costs, logged every second
+  StateRecorder recorder;   // every State sent, when BOLT_RECORD names a file
   SoundSource soundSource;
   gam::SamplePlayer<> samplePlayer[N_SAMPLE_PLAYER];
   int currentPlayer = 0;
 
   cuttlebone::Maker<State> maker;  // XXX
-  State state;                     // XXX
+  SharedStateWriter shared;  // used instead of the maker with --transport shm
+  int broadcastEvery;  // frames per State sent, the renderers draw between them
+  int sinceBroadcast;
   PS ps;
 
   AlloApp() 
-    : maker(Simulator::defaultBroadcastIP()),                        // XXX
+    : sim(wallMicros()),
+      maker(Simulator::defaultBroadcastIP()),                        // XXX
         InterfaceServerClient(Simulator::defaultInterfaceServerIP()) // XXX
         {
 
-    printFactsAboutState(sizeof(State));
-
-    time = 0;
-    pace = 1.0;
-    upperbound = 2.5;
-    center = Vec3f(0, 0.6, -1);
-    nucleusPose = center;
-    state.frame = 0;  // XXX
+    broadcastEvery = 1;
+    sinceBroadcast = 0;
+    bulges[0] = bulges[1] = 0;
+    shadersBuilt = false;
+    telemetry.open("simulator_telemetry.csv");
+    if (const char* path = getenv("BOLT_RECORD")) {
+      if (recorder.open(path)) cout << "Recording the States to " << path << endl;
+      else cout << "Can't record the States to " << path << endl;
+    }
+    PROFILE_THREAD("main");
 
     //add nucleus and shell
     addSphere(nucleus, 0.1, 64, 64);
@@ -130,11 +141,13 @@ struct AlloApp : App, AlloSphereAudioSpatializer, InterfaceServerClient {
     nav().set(Pose(Vec3d(0.000000, 0.454005, -0.011147), Quatd(0.999998, -0.001988, 0.000000, 0.000000)));
   
     //initiate phasespace
-    if(Simulator::sim()) ps.init(&nav(), &state, &boltQ, samplePlayer, &currentPlayer); // Use in sphere
-    else ps.initTest(&nav(), &state, &boltQ, samplePlayer, &currentPlayer); // Use on laptop
+    if(Simulator::sim()) ps.init(&nav(), &sim.state, &sim.boltQ, samplePlayer, &currentPlayer); // Use in sphere
+    else ps.initTest(&nav(), &sim.state, &sim.boltQ, samplePlayer, &currentPlayer); // Use on laptop
   }
 
   virtual void onDraw (Graphics& g, const Viewpoint& v) {
+    PROFILE("onDraw");
+    const Vec3f& nucleusPose = sim.nucleusPose;
     //add lighting specular 
     material.specular(light.diffuse() * 0.2);  // Specular highlight, "shine"
     material.shininess(50);  // Concentration of specular component [0,128]
@@ -144,24 +157,13 @@ struct AlloApp : App, AlloSphereAudioSpatializer, InterfaceServerClient {
 
     // draw behind lightnings
     g.blendMode(g.ONE, g.ONE);
-    for(std::deque<Bolt*> :: iterator it = boltQ.begin() ; it!= boltQ.end();it++){
-      Bolt* bolt = *it;
-      if ((nav().pos() - nucleusPose).dot(bolt->ending - nucleusPose) < 0){
-        g.depthTesting(false);
-        g.blending(true);
-        bolt->texture.bind();
-        g.draw(bolt->mesh);
-        bolt->texture.unbind();
-        //bulge
-        g.blending(false);
-        g.depthTesting(true);
-        g.pushMatrix();
-          g.translate(bolt->bulgePosition);
-          g.scale(bolt->bulgeScale);
-          g.draw(bolt->bulgeMesh);
-        g.popMatrix();
-      }
-    }
+    g.depthTesting(false);
+    g.blending(true);
+    drawBolts(g, false);
+    //bulge
+    g.blending(false);
+    g.depthTesting(true);
+    drawBulges(false);
     
     //draw newcleus
     g.blending(false);
@@ -173,124 +175,201 @@ struct AlloApp : App, AlloSphereAudioSpatializer, InterfaceServerClient {
     
     // draw front lightnings
     g.blendMode(g.ONE, g.ONE);
-    for(std::deque<Bolt*> :: iterator it = boltQ.begin() ; it!= boltQ.end();it++){
-      Bolt* bolt = *it;
-      if ((nav().pos() - nucleusPose).dot(bolt->ending - nucleusPose) >= 0){
-        if(bolt->ending == Vec3f(0.1f, 0.6f, -1.f)){
-          cout<<"starting point: "<<bolt->start<<endl;
-        }
-        g.depthTesting(false);
-        g.blending(true);
-        bolt->texture.bind();
-        g.draw(bolt->mesh);
-        bolt->texture.unbind();
-        //bulge
-        g.blending(false);
-        g.depthTesting(true);
-        g.pushMatrix();
-          g.translate(bolt->bulgePosition);
-          g.scale(bolt->bulgeScale);
-          g.draw(bolt->bulgeMesh);
-        g.popMatrix();
-      }  
-    }
+    g.depthTesting(false);
+    g.blending(true);
+    drawBolts(g, true);
+    //bulge
+    g.blending(false);
+    g.depthTesting(true);
+    drawBulges(true);
 
     //draw shell
     g.depthTesting(true);
     g.blending(true);
     g.blendModeTrans();
     g.draw(shell);
+
+    //frame phase timings
+    if (hud.visible) {
+      g.depthTesting(false);
+      g.blending(false);
+      g.draw(hud.mesh);
+    }
   }
 
-  virtual void onAnimate(double dt) {
-    // accumulate time steps (dt) into our time variable.
-    time += dt;
+  // the shaders are built the first time there is a GL context to build
+  // them in
+  void buildShaders() {
+    if (shadersBuilt) return;
+    boltShader.compile(boltVertexCode(), boltFragmentCode());
+    bulgeShader.compile(bulgeVertexCode(), bulgeFragmentCode());
+    shadersBuilt = true;
+  }
+
+  // one side of the batch, faded by the shader
+  void drawBolts(Graphics& g, bool front) {
+    buildShaders();
+    boltShader.begin();
+    boltShader.uniform("texture0", 0);
+    boltSprite().bind();
+    batch.draw(g, front, boltShader.attribute("fade"));
+    boltSprite().unbind();
+    boltShader.end();
+  }
+
+  static std::string boltVertexCode() {
+    return R"(
+attribute vec2 fade;  // falloff and fade exponent
+varying vec4 color;
+void main() {
+  color = gl_Color * pow(fade.x, fade.y);
+  gl_TexCoord[0] = gl_MultiTexCoord0;
+  gl_Position = ftransform();
+}
+)";
+  }
+
+  static std::string boltFragmentCode() {
+    return R"(
+uniform sampler2D texture0;
+varying vec4 color;
+void main() {
+  gl_FragColor = color * texture2D(texture0, gl_TexCoord[0].st);
+}
+)";
+  }
+
+  // one side's bulges in one instanced draw of the shared sphere, the
+  // vertex shader places each instance from its instance attributes
+  void drawBulges(bool front) {
+    int side = front ? 1 : 0;
+    if (bulges[side] == 0) return;
+    buildShaders();
+    GLint instance = bulgeShader.attribute("instance");
+    GLint instanceColor = bulgeShader.attribute("instanceColor");
+    if (instance < 0 || instanceColor < 0) return;
+    Mesh& sphere = bulgeSphere();
+
+    bulgeShader.begin();
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, &sphere.vertices()[0]);
+    glNormalPointer(GL_FLOAT, 0, &sphere.normals()[0]);
+    glEnableVertexAttribArray(instance);
+    glVertexAttribPointer(instance, 4, GL_FLOAT, GL_FALSE, 0, bulgeInstance[side]);
+    glVertexAttribDivisor(instance, 1);
+    glEnableVertexAttribArray(instanceColor);
+    glVertexAttribPointer(instanceColor, 4, GL_FLOAT, GL_FALSE, 0, bulgeTint[side]);
+    glVertexAttribDivisor(instanceColor, 1);
+
+    glDrawElementsInstanced(GL_TRIANGLES, sphere.indices().size(), GL_UNSIGNED_INT,
+                            &sphere.indices()[0], bulges[side]);
+
+    glVertexAttribDivisor(instance, 0);
+    glVertexAttribDivisor(instanceColor, 0);
+    glDisableVertexAttribArray(instance);
+    glDisableVertexAttribArray(instanceColor);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    bulgeShader.end();
+  }
+
+  static std::string bulgeVertexCode() {
+    return R"(
+attribute vec4 instance;  // xyz position, w scale
+attribute vec4 instanceColor;
+varying vec4 color;
+varying vec3 normal, lightDir, eyeVec;
+void main() {
+  vec4 vertex = gl_ModelViewMatrix * vec4(gl_Vertex.xyz * instance.w + instance.xyz, 1.0);
+  color = instanceColor;
+  normal = gl_NormalMatrix * gl_Normal;
+  eyeVec = normalize(-vertex.xyz);
+  lightDir = normalize(gl_LightSource[0].position.xyz - vertex.xyz);
+  gl_Position = gl_ProjectionMatrix * vertex;
+}
+)";
+  }
 
-    if (time > pace) {
+  // lit the way the fixed function pipeline lit the bulges before
+  static std::string bulgeFragmentCode() {
+    return R"(
+varying vec4 color;
+varying vec3 normal, lightDir, eyeVec;
+void main() {
+  vec3 N = normalize(normal);
+  vec4 lit = color * gl_LightSource[0].ambient;
+  lit += gl_LightSource[0].diffuse * color * max(dot(N, lightDir), 0.0);
+  vec3 R = reflect(-lightDir, N);
+  lit += gl_LightSource[0].specular * gl_FrontMaterial.specular *
+         pow(max(dot(R, normalize(eyeVec)), 0.0), gl_FrontMaterial.shininess);
+  gl_FragColor = vec4(lit.rgb, color.a);
+}
+)";
+  }
+
+  virtual void onAnimate(double dt) {
+    PROFILE("onAnimate");
+    if (sim.advance(dt)) {
       // trigger a lightning to start
       //Audio 
       samplePlayer[currentPlayer].reset(); // reset the phase == start playing the sound
       currentPlayer++;
       if (currentPlayer == N_SAMPLE_PLAYER)
         currentPlayer = 0;
-
-      //wiggle 
-      nucleusPose += Vec3f(rnd::uniformS(0.006),rnd::uniformS(0.006),rnd::uniformS(0.006)); 
-      
-      //generate starting and ending point
-      float z = 4.7f * rnd::uniformS();
-      float y = R * rnd::uniformS();
-      float x;
-      if(R*R - z*z - y*y<=0){
-        x = 0.f;
-      }else {
-        x = sqrt(R*R - z*z - y*y);
-      }
-      float sign = rnd::uniformS();
-      if(sign <= 0){
-        sign = -1;
-      }else{
-        sign = 1;
-      }
-      Vec3f source = Vec3f(sign * x, y, z);
-      Vec3f dest = (source - center).normalize() * 0.1f + center;
-      affection = (source - center).normalize() * 0.1;
-      Bolt* newBolt = new Bolt();
-      newBolt->makeTexture();
-      newBolt->start = source;
-      newBolt->ending = dest;
-      newBolt->makeBolt(source, dest, 4, 0.06);
-      newBolt->createBulge(nucleusPose);
-      boltQ.push_back(newBolt); // XXX
-      //reset time and pace
-      time = 0;
-      pace = rnd::uniform(upperbound, 0.0);
-    } else {
-      nucleusPose = center;
     }
     //call phasespace
-    ps.step(dt);
-    //fade out all the bolt in vector
-    for(std::deque<Bolt*> :: iterator it = boltQ.begin() ; it!= boltQ.end();it++){
-      Bolt* bolt = *it;
-      bolt->fadeOut();
-      bolt->countDown(dt);
-      bolt->bulge(nucleusPose);
-      //delete the one already disappear
-      if(bolt->timer < 0.002 && it == boltQ.begin()){
-        Bolt* delete_me = *boltQ.begin();
-        boltQ.pop_front();
-        delete delete_me;
+    {
+      PROFILE("phasespace");
+      ps.step(dt);
+    }
+    sim.settle();
+    //pack what is left into one mesh per side of the nucleus
+    {
+      PROFILE("batch");
+      batch.reset();
+      bulges[0] = bulges[1] = 0;
+      const BoltSystem& live = sim.boltQ.live;
+      for(int i = 0; i < live.size(); i++){
+        const Bolt& bolt = *live.bolt[i];
+        batch.add(bolt, nav().pos(), sim.nucleusPose, live.fadeExponent[i]);
+        // on the same side of the nucleus as its bolt
+        int side = (nav().pos() - sim.nucleusPose).dot(bolt.ending - sim.nucleusPose) < 0 ? 0 : 1;
+        bulgeInstance[side][bulges[side]] = Vec4f(live.bulgeX[i], live.bulgeY[i], live.bulgeZ[i], live.bulgeScale[i]);
+        bulgeTint[side][bulges[side]] = bolt.bulgeColor;
+        bulges[side]++;
       }
     }
+    hud.update();
+    hud.build(nav());
 
     //simulator setting
-    state.numberOfBolts = boltQ.size(); // XXX
-    int i = 0;
-    for(std::deque<Bolt*> :: iterator it = boltQ.begin() ; it!= boltQ.end();it++){
-      Bolt* bolt = *it;
-      if(i< boltQ.size() && i< 5){
-        state.flatBolt[i].numberOfPoints = bolt->mesh.vertices().size(); // XXX
-        state.flatBolt[i].ending = bolt->ending;
-        state.flatBolt[i].bulgePosition = bolt->bulgePosition;
-        state.flatBolt[i].bulgeScale = bolt->bulgeScale;
-        for(int j = 0; j < bolt->mesh.vertices().size() && j<VERTEX_COUNT; j++){
-          state.flatBolt[i].points[j] = bolt->mesh.vertices()[j];  // XXX
-          state.flatBolt[i].textCoe[j] = bolt->mesh.texCoord2s()[j];
-          state.flatBolt[i].color[j] = bolt->mesh.colors()[j];
-        }
-      }else{
-        break;
+    if (++sinceBroadcast < broadcastEvery) return;
+    sinceBroadcast = 0;
+    // shared memory gets the frame packed straight into its slot
+    if (shared.opened()) {
+      State& state = sim.pack(nav(), hud.visible, shared.next());
+      PROFILE("publish");
+      telemetry.sending(state);
+      shared.publish();
+      telemetry.sent(state);
+      recorder.record(state);
+    } else {
+      State& state = sim.pack(nav(), hud.visible); // XXX
+      {
+        PROFILE("maker.set");
+        telemetry.sending(state);
+        maker.set(state);  // XXX
+        telemetry.sent(state);
       }
-      i++;
+      recorder.record(state);
     }
-    state.nucleusPose = nucleusPose;
-    state.pose = nav(); // XXX
-    maker.set(state);  // XXX
-    state.frame++; // XXX
+    sim.state.frame++; // XXX
   }
 
   virtual void onSound(AudioIOData& io) {
+    PROFILE_THREAD("audio");
+    PROFILE("onSound");
     soundSource.pose(Pose(Vec3f(0,0.6,-1), Quatf()));
     listener()->pose(nav());
 
@@ -307,19 +386,25 @@ struct AlloApp : App, AlloSphereAudioSpatializer, InterfaceServerClient {
 
   virtual void onKeyDown(const ViewpointWindow&, const Keyboard& k) {
     if (k.key() == 'p') {
-      cout << "Pace of the lightning is: "<< pace << endl;
+      cout << "Pace of the lightning is: "<< sim.pace << endl;
+    }else if(k.key() == 'h'){
+      hud.visible = !hud.visible;
+    }else if(k.key() == 't'){
+      if(Profiler::shared().writeTrace("simulator_trace.json")){
+        cout << "Frame phases written to simulator_trace.json" << endl;
+      }
     }else if( k.key() == '='){
-      upperbound -= 0.5;
-      if(upperbound <= 0){
-        upperbound = 0.5;
+      sim.upperbound -= 0.5;
+      if(sim.upperbound <= 0){
+        sim.upperbound = 0.5;
       }
-      cout << "Increase the pace by 0.5s:  pace = "<< upperbound << endl;
+      cout << "Increase the pace by 0.5s:  pace = "<< sim.upperbound << endl;
     }else if(k.key() == '-'){
-      upperbound += 0.5;
-      if(upperbound >= 30){
-        upperbound = 30;
+      sim.upperbound += 0.5;
+      if(sim.upperbound >= 30){
+        sim.upperbound = 30;
       }
-      cout << "Decrease the pace by 0.5s:  pace = "<< upperbound << endl;
+      cout << "Decrease the pace by 0.5s:  pace = "<< sim.upperbound << endl;
     }
   }
 
@@ -334,7 +419,6 @@ struct AlloApp : App, AlloSphereAudioSpatializer, InterfaceServerClient {
     Vec3f dest = 0.1f * (src - center).normalize() + center;
     //create new bolt
     Bolt* newMouseBolt = new Bolt();
-    newMouseBolt->makeTexture();
     newMouseBolt->makeBolt(src, dest, 2, 0.03);
     boltQ.push_back(newMouseBolt);
     //animate nucleus
@@ -345,54 +429,34 @@ struct AlloApp : App, AlloSphereAudioSpatializer, InterfaceServerClient {
 
 };
 
-int main() {
+// simulator_4 [--transport udp | shm] [--broadcast-every N]
+// shm hands the States to a renderer on this machine through shared
+// memory instead of broadcasting them. --broadcast-every 2 sends every
+// other frame, 30 States a second, and the renderers draw between them
+int main(int argc, char* argv[]) {
+  Transport transport = TRANSPORT_UDP;
+  int broadcastEvery = 1;
+  for (int i = 1; i < argc; i++) {
+    string flag = argv[i];
+    if (flag == "--transport" && i + 1 < argc && parseTransport(argv[i + 1], transport)) {
+      i++;
+    } else if (flag == "--broadcast-every" && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+      broadcastEvery = atoi(argv[++i]);
+    } else {
+      cerr << "usage: " << argv[0] << " [--transport udp | shm] [--broadcast-every N]" << endl;
+      return 1;
+    }
+  }
   AlloApp app;
+  app.broadcastEvery = broadcastEvery;
   app.AlloSphereAudioSpatializer::audioIO().start();  // start audio
   app.InterfaceServerClient::connect();  // handshake with interface server
-  app.maker.start();  // XXX
-  app.start();
-}
-
-
-void printFactsAboutState(int size) {
-  cout << "==================================================" << endl;
-  cout << "Your state type takes " << size << " bytes in memory." << endl;
-
-  if (size > 1024.0f * 1024.0f * 1024.0f) {
-    cout << "That is " << size / (1024.0f * 1024.0f * 1024.0f) << " gigabytes."
-         << endl;
-    cout << "That's too big." << endl;
-  } else if (size > 1024.0f * 1024.0f * 10) {
-    cout << "That is " << size / (1024.0f * 1024.0f) << " megabytes." << endl;
-    cout << "That's a very big state." << endl;
-  } else if (size > 1024.0f * 1024.0f) {
-    cout << "That is " << size / (1024.0f * 1024.0f) << " megabytes." << endl;
-  } else if (size > 1024.0f) {
-    cout << "That is " << size / 1024.0f << " kilobytes." << endl;
+  if (transport == TRANSPORT_SHARED) {
+    if (!app.shared.create()) return 1;
   } else {
+    app.maker.start();  // XXX
   }
-
-  // Standard 1Gb Ethernet effective bandwidth
-  //
-  float gbe = 1.18e+8f;
-
-  cout << "On a 1Gb Ethernet LAN (like the MAT network), ";
-  if (gbe / size > 60.0f)
-    cout << "you will use \n" << 100.0f * (size * 60.0f) / gbe
-         << "\% of the effective bandwidth with a framerate of 60 Hz." << endl;
-  else
-    cout << "your framerate will be *network limited* to " << gbe / size
-         << " Hz." << endl;
-
-  cout << "On a 10Gb Ethernet LAN (like the AlloSphere network), ";
-  if (10 * gbe / size > 60.0f)
-    cout << "you will use \n" << 100.0f * (size * 60.0f) / (10 * gbe)
-         << "\% of the effective bandwidth with a framerate of 60 Hz." << endl;
-  else {
-    cout << "your framerate will be *network limited* to " << 10 * gbe / size
-         << " Hz." << endl;
-    cout << "Your state is very large." << endl;
-  }
-  cout << "==================================================" << endl;
+  app.sim.worker.start();  // bolt generation off the animation thread
+  Profiler::traceOnExit();  // BOLT_TRACE=file saves the frame phases at exit
+  app.start();
 }
-
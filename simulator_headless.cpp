@@ -0,0 +1,206 @@
+//
+// MAT201B Final Project
+// Fall 2015
+//
+// The simulator with no window, no audio device and no PhaseSpace, for
+// soak and load tests on a machine without AlloSystem. It runs the same
+// PlasmaSimulation as simulator_4.cpp, bolt worker included, with
+// SimulatedPinches for the gloves, and hands every State it produces to a
+// local sink instead of broadcasting it:
+//
+//    g++ -std=c++11 -O2 -pthread simulator_headless.cpp -o simulator_headless
+//    ./simulator_headless --steps 1000000 --rate 0 > soak.json
+//
+//    --steps N     stop after N frames, 0 runs until interrupted (default)
+//    --rate HZ     frames per second to run at, 0 runs flat out (default 60).
+//                  either way a frame is 1/HZ seconds of simulator time,
+//                  1/ANIMATION_RATE when flat out. flat out, each frame
+//                  waits for the worker to finish the strikes it asked for,
+//                  so bolts live as many frames as at 60 Hz
+//    --pace S      longest time between timed strikes (default 2.5)
+//    --pinch HZ    simulated pinches per second of simulator time (default 0.5)
+//    --seed N      strikes and pinches, the same seed makes the same strikes
+//    --record FILE record every State to FILE for render_allosphere_4
+//                  --replay or state_replay, otherwise each is only copied
+//                  the way cuttlebone::Maker::set copies it
+//    --no-worker   generate strikes on the simulation thread
+//    --transport shm
+//                  pack every State straight into shared memory for a
+//                  render_allosphere_4 --transport shm on this machine
+//    --broadcast-every N
+//                  hand on a State every N frames, like simulator_4's
+//
+// stderr gets a line a second: frames, frames per second, live and spare
+// bolts, peak RSS. When it stops, stdout gets one JSON object with the
+// totals. BOLT_TRACE=file saves the frame phases on exit.
+//
+
+#define BOLT_HEADLESS
+#include "bolt_headless.hpp"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <sys/resource.h>
+
+using namespace al;
+using namespace std;
+
+#include "plasma_simulation.hpp"
+
+// where the States go, a recording, or a copy like cuttlebone's unless
+// they are already in shared memory
+class StateSink {
+  public:
+  long states;
+  double bytes;  // what cuttlebone would have sent
+  bool copying;
+
+  StateSink() : states(0), bytes(0), copying(true) {}
+
+  bool open(const char* path){ return recorder.open(path); }
+
+  void write(const State& state){
+    if(recorder.recording()){
+      recorder.record(state);
+    }else if(copying){
+      memcpy(&copy, &state, sizeof(State));
+    }
+    states++;
+    bytes += sizeof(State);
+  }
+
+  private:
+  StateRecorder recorder;
+  State copy;
+};
+
+// kilobytes on Linux, bytes on macOS
+static double peakResidentMegabytes(){
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1e6;
+#else
+  return usage.ru_maxrss / 1e3;
+#endif
+}
+
+static volatile sig_atomic_t interrupted = 0;
+static void interrupt(int){ interrupted = 1; }
+
+int main(int argc, char* argv[]) {
+  long steps = 0;
+  double rate = 60;
+  double upperbound = 2.5;
+  double pinchRate = 0.5;
+  uint64_t seed = 1;
+  const char* recordPath = 0;
+  bool useWorker = true;
+  int broadcastEvery = 1;
+  Transport transport = TRANSPORT_UDP;
+  for (int i = 1; i < argc; i++) {
+    const char* flag = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : 0;
+    if (!strcmp(flag, "--no-worker")) {
+      useWorker = false;
+      continue;
+    }
+    if (!value) {
+      fprintf(stderr, "unknown option or missing value: %s\n", flag);
+      return 1;
+    }
+    if (!strcmp(flag, "--steps")) steps = atol(value);
+    else if (!strcmp(flag, "--rate")) rate = atof(value);
+    else if (!strcmp(flag, "--pace")) upperbound = atof(value);
+    else if (!strcmp(flag, "--pinch")) pinchRate = atof(value);
+    else if (!strcmp(flag, "--seed")) seed = strtoull(value, 0, 10);
+    else if (!strcmp(flag, "--record")) recordPath = value;
+    else if (!strcmp(flag, "--transport") && parseTransport(value, transport)) {}
+    else if (!strcmp(flag, "--broadcast-every") && atoi(value) > 0) broadcastEvery = atoi(value);
+    else {
+      fprintf(stderr, "unknown option: %s\n", flag);
+      return 1;
+    }
+    i++;
+  }
+
+  static PlasmaSimulation sim(seed);  // a State is too big for the stack
+  static StateSink sink;
+  static SharedStateWriter shared;
+  SimulatedPinches pinches(pinchRate, seed + 1);
+  sim.upperbound = upperbound;
+  if (recordPath && !sink.open(recordPath)) {
+    fprintf(stderr, "can't record States to %s\n", recordPath);
+    return 1;
+  }
+  if (transport == TRANSPORT_SHARED) {
+    if (!shared.create()) return 1;
+    sink.copying = false;
+  }
+  // where simulator_4.cpp puts the viewer
+  Pose viewer(Vec3d(0.000000, 0.454005, -0.011147), Quatd(0.999998, -0.001988, 0.000000, 0.000000));
+
+  signal(SIGINT, interrupt);
+  signal(SIGTERM, interrupt);
+  Profiler::traceOnExit();
+  PROFILE_THREAD("simulation");
+  if (useWorker) sim.worker.start();
+
+  const double dt = rate > 0 ? 1 / rate : 1 / ANIMATION_RATE;
+  auto start = chrono::steady_clock::now();
+  auto next = start;
+  auto reported = start;
+  long reportedSteps = 0, strikes = 0, step = 0;
+  int mostLive = 0;
+  for (; !interrupted && (steps == 0 || step < steps); step++) {
+    {
+      PROFILE("frame");
+      if (sim.advance(dt)) strikes++;
+      pinches.step(dt, sim);
+      if (rate <= 0) {
+        PROFILE("drain");
+        while (sim.worker.started() && sim.worker.busy()) this_thread::yield();
+      }
+      sim.settle();
+      if (step % broadcastEvery == 0) {
+        if (shared.opened()) {
+          State& state = sim.pack(viewer, false, shared.next());
+          state.sent = wallMicros();
+          shared.publish();
+          sink.write(state);
+        } else {
+          sink.write(sim.pack(viewer, false));
+        }
+        sim.state.frame++;
+      }
+    }
+    mostLive = max(mostLive, sim.boltQ.size());
+
+    auto now = chrono::steady_clock::now();
+    if (now - reported >= chrono::seconds(1)) {
+      double seconds = chrono::duration<double>(now - reported).count();
+      fprintf(stderr, "%10ld frames %9.0f frames/s %8.0f s simulated %4d live %4d spare %8.1f MB peak RSS\n",
+              step + 1, (step + 1 - reportedSteps) / seconds, sim.state.time, sim.boltQ.size(),
+              sim.boltQ.spares, peakResidentMegabytes());
+      reported = now;
+      reportedSteps = step + 1;
+    }
+    if (rate > 0) {
+      next += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(dt));
+      this_thread::sleep_until(next);
+    }
+  }
+  sim.worker.stop();
+
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  printf("{\"frames\":%ld,\"seconds\":%.3f,\"frames_per_second\":%.1f,\"simulated_seconds\":%.1f,"
+         "\"strikes\":%ld,\"live\":%d,\"most_live\":%d,\"spare\":%d,\"state_bytes\":%d,"
+         "\"sink_megabytes\":%.1f,\"peak_rss_megabytes\":%.1f}\n",
+         step, seconds, step / seconds, sim.state.time, strikes, sim.boltQ.size(), mostLive,
+         sim.boltQ.spares, (int)sizeof(State), sink.bytes / 1e6, peakResidentMegabytes());
+  return 0;
+}
@@ -0,0 +1,144 @@
+//
+// MAT201B Final Project
+// Fall 2015
+//
+// Replays a State recording through the renderer's per-frame CPU work,
+// BoltCache::unpack and the two bolt batches render_allosphere_4.cpp
+// builds, without a window or GL. The same recording gives the same frames
+// every run, so it is a repeatable renderer benchmark, and the slowest
+// frames it lists can be stepped through afterwards:
+//
+//    g++ -std=c++11 -O2 -pthread state_replay.cpp -o state_replay
+//    ./state_replay show.plasma                  # as fast as possible
+//    ./state_replay show.plasma --realtime       # at the recorded speed
+//    ./state_replay show.plasma --step --from 5400
+//
+//    --realtime    keep to the recorded State::time
+//    --step        one frame per line on stdin, printing what it holds
+//    --from N      start at simulator frame N (via the index)
+//    --frames N    stop after N frames
+//    --info        print what the index says and stop
+//    --no-worker   lay out breakdown bolts in the frame that needs them
+//                  rather than on a worker, as the renderer does
+//
+// Recordings come from the simulator with BOLT_RECORD=file, or
+// simulator_headless --record file. Build with the same -D flags as the
+// program that recorded it. stdout gets one JSON object with the frame
+// time percentiles and the slowest frames.
+//
+
+#define BOLT_HEADLESS
+#include "bolt_headless.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace al;
+using namespace std;
+
+#include "common_4.hpp"
+
+struct FrameTime {
+  double ms;
+  int frame;  // State::frame
+  bool operator<(const FrameTime& f) const { return ms > f.ms; }
+};
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "usage: %s recording [--realtime | --step] [--from N] [--frames N] [--info] [--no-worker]\n",
+            argv[0]);
+    return 1;
+  }
+  static StateReplay replay;
+  static BoltCache cache;  // both too big for the stack
+  static BoltWorker worker;
+  static State state;
+  BoltBatch batch;
+  replay.mode = REPLAY_FAST;
+  replay.loop = false;
+  int from = -1, limit = 0;
+  bool info = false;
+  bool useWorker = true;
+  for (int i = 2; i < argc; i++) {
+    const char* flag = argv[i];
+    if (!strcmp(flag, "--realtime")) replay.mode = REPLAY_REAL_TIME;
+    else if (!strcmp(flag, "--step")) replay.mode = REPLAY_STEP;
+    else if (!strcmp(flag, "--info")) info = true;
+    else if (!strcmp(flag, "--no-worker")) useWorker = false;
+    else if (!strcmp(flag, "--from") && i + 1 < argc) from = atoi(argv[++i]);
+    else if (!strcmp(flag, "--frames") && i + 1 < argc) limit = atoi(argv[++i]);
+    else {
+      fprintf(stderr, "unknown option: %s\n", flag);
+      return 1;
+    }
+  }
+  if (!replay.open(argv[1])) return 1;
+  int frames = replay.frames();
+  if (frames == 0) {
+    fprintf(stderr, "%s has no frames\n", argv[1]);
+    return 1;
+  }
+  fprintf(stderr, "%d frames, %d .. %d, %.1f s of simulator time\n", frames, replay.frameNumber(0),
+          replay.frameNumber(frames - 1), replay.time(frames - 1) - replay.time(0));
+  if (info) return 0;
+  if (from >= 0) replay.seek(replay.find(from));
+  if (useWorker) {
+    worker.ribbon = RIBBON_FACING;
+    cache.worker = &worker;
+    worker.start();
+  }
+
+  vector<FrameTime> times;
+  int missed = 0;  // frames realtime had to skip
+  auto start = chrono::steady_clock::now();
+  while (limit == 0 || (int)times.size() < limit) {
+    if (replay.mode == REPLAY_STEP) {
+      char line[64];
+      if (!fgets(line, sizeof line, stdin)) break;
+      replay.step();
+    }
+    auto begin = chrono::steady_clock::now();
+    int advanced = replay.get(state);
+    if (advanced == 0) {
+      if (replay.position() == frames - 1) break;
+      this_thread::sleep_for(chrono::milliseconds(1));  // the next frame isn't due yet
+      continue;
+    }
+    missed += advanced - 1;
+    cache.unpack(state);
+    const BoltSystem& live = cache.animated;
+    batch.reset();
+    for (int i = 0; i < live.size(); i++) {
+      batch.add(*live.bolt[i], state.pose.pos(), state.nucleusPose, live.fadeExponent[i]);
+    }
+    FrameTime t;
+    t.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+    t.frame = state.frame;
+    times.push_back(t);
+    if (replay.mode == REPLAY_STEP) {
+      fprintf(stderr, "frame %d  t %.3f s  %d bolts  %d geometries  %d live  %d + %d vertices  %.3f ms\n",
+              state.frame, state.time, state.numberOfBolts, state.numberOfGeometries, live.size(),
+              batch.behind.vertices().size(), batch.front.vertices().size(), t.ms);
+    }
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  if (times.empty()) return 0;
+
+  vector<FrameTime> sorted = times;
+  sort(sorted.begin(), sorted.end());  // slowest first
+  int n = sorted.size();
+  printf("{\"frames\":%d,\"missed\":%d,\"seconds\":%.3f,\"p50_ms\":%.4f,\"p99_ms\":%.4f,"
+         "\"max_ms\":%.4f,\"slowest\":[",
+         n, missed, seconds, sorted[n / 2].ms, sorted[n / 100].ms, sorted[0].ms);
+  for (int i = 0; i < min(n, 5); i++) {
+    printf("%s{\"frame\":%d,\"ms\":%.4f}", i ? "," : "", sorted[i].frame, sorted[i].ms);
+  }
+  printf("]}\n");
+  return 0;
+}